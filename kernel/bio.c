@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,10 +12,32 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
-
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks
+// rarely contend. Moving a buffer between buckets locks
+// both, lower index first.
+//
+// The cache is sized from free memory at boot, grows on
+// misses up to a quarter of the free memory at boot, and
+// gives pages back when kalloc() runs out (bshrink). Buffers
+// come in groups of BPG that share one data page, so a
+// group's page can be freed once none of its buffers is in
+// use. Group headers are never freed.
+//
+// Eviction is a scan-resistant CLOCK. A newly read block is
+// cold. A cold block referenced again after the hand has
+// passed it since it was read becomes hot; references in
+// quick succession, as in a sequential scan, don't count.
+// The hand recycles unused cold buffers that haven't been
+// referenced since its last pass, and only demotes hot
+// buffers to cold while more than HOTPCT percent of the
+// cache is hot. A long scan therefore cycles through the
+// cold buffers and leaves hot metadata blocks alone.
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
@@ -23,33 +45,302 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define NBUCKET 61
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+#define BPG     (PGSIZE / BSIZE)                      // buffers per data page
+#define NGROUP  ((PHYSTOP - KERNBASE) / PGSIZE / 4)   // at most 1/4 of RAM
+#define HOTPCT  75                                    // max % of hot buffers
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
+// Buffers with no block of their own use dev 0, which
+// bread() is never called with, so lookups never match them.
+#define NODEV   0
+
+struct bucket {
+  struct spinlock lock;
+  // Circular list of the buffers in this bucket,
+  // through prev/next.
   struct buf head;
+};
+
+// BPG buffers sharing one page of block data.
+struct bgroup {
+  char *page;   // 0 if the page has been given back
+  struct buf buf[BPG];
+};
+
+struct {
+  struct bucket bucket[NBUCKET];
+
+  // Protects adding groups and giving pages back.
+  struct spinlock growlock;
+  struct bgroup *group[NGROUP];
+  int ngroup;   // groups allocated; group[] only grows
+  int maxgroup; // grow on misses up to this many pages
+  int npages;   // groups with a data page
+  int nhot;     // hot buffers
+  uint hand;    // CLOCK hand, an index into the buffers
 } bcache;
 
+static void
+bucket_insert(int h, struct buf *b)
+{
+  struct buf *head = &bcache.bucket[h].head;
+
+  b->bucket = h;
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+static void
+bucket_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->bucket = -1;
+}
+
+// Look for block (dev, blockno) in bucket h.
+// Caller must hold the bucket's lock.
+static struct buf*
+bucket_find(int h, uint dev, uint blockno)
+{
+  struct buf *head = &bcache.bucket[h].head;
+  struct buf *b;
+
+  for(b = head->next; b != head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Caller holds b's bucket lock.
+static void
+setcold(struct buf *b)
+{
+  if(b->hot){
+    b->hot = 0;
+    __sync_fetch_and_add(&bcache.nhot, -1);
+  }
+}
+
+// Note a hit on b. Caller holds b's bucket lock.
+static void
+touch(struct buf *b)
+{
+  if(!b->hot && !b->recent){
+    // referenced again after the hand cleared recent.
+    b->hot = 1;
+    __sync_fetch_and_add(&bcache.nhot, 1);
+  }
+  b->recent = 1;
+}
+
+// Give group g the data page pa, and put its buffers
+// in the buckets as free buffers.
+// Caller holds bcache.growlock.
+static void
+group_fill(struct bgroup *g, char *pa)
+{
+  struct buf *b;
+  int h;
+
+  g->page = pa;
+  for(b = g->buf; b < g->buf + BPG; b++){
+    b->data = (uchar*)pa + (b - g->buf) * BSIZE;
+    b->dev = NODEV;
+    b->blockno = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->recent = 0;
+    b->hot = 0;
+    h = BHASH(b->dev, b->blockno);
+    acquire(&bcache.bucket[h].lock);
+    bucket_insert(h, b);
+    release(&bcache.bucket[h].lock);
+  }
+  bcache.npages++;
+}
+
+// Add one page worth of buffers to the cache.
+// Returns 0 on success, -1 if out of memory.
+static int
+bgrow(void)
+{
+  struct bgroup *g = 0;
+  char *pa;
+  int i;
+
+  // Allocate before taking growlock: kalloc()
+  // may call bshrink(), which takes it.
+  if((pa = kalloc()) == 0)
+    return -1;
+
+  acquire(&bcache.growlock);
+  // Reuse a group whose page was given back.
+  for(i = 0; i < bcache.ngroup; i++){
+    if(bcache.group[i]->page == 0){
+      g = bcache.group[i];
+      break;
+    }
+  }
+  if(g == 0 && bcache.ngroup < NGROUP){
+    release(&bcache.growlock);
+    g = kmalloc(sizeof(struct bgroup));
+    acquire(&bcache.growlock);
+    if(g){
+      memset(g, 0, sizeof(*g));
+      for(i = 0; i < BPG; i++){
+        initsleeplock(&g->buf[i].lock, "buffer");
+        g->buf[i].bucket = -1;
+      }
+      if(bcache.ngroup < NGROUP){
+        bcache.group[bcache.ngroup] = g;
+        // clockbuf() reads group[] without growlock.
+        __sync_synchronize();
+        bcache.ngroup++;
+      } else {
+        kmfree(g);
+        g = 0;
+      }
+    }
+  }
+  if(g == 0){
+    release(&bcache.growlock);
+    kfree(pa);
+    return -1;
+  }
+  group_fill(g, pa);
+  release(&bcache.growlock);
+  return 0;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  int h, n;
+
+  for(h = 0; h < NBUCKET; h++){
+    initlock(&bcache.bucket[h].lock, "bcache");
+    bcache.bucket[h].head.prev = &bcache.bucket[h].head;
+    bcache.bucket[h].head.next = &bcache.bucket[h].head;
+  }
+  initlock(&bcache.growlock, "bcache.grow");
+
+  // Start with 1/16 of free memory, and allow
+  // growing to 1/4 of it.
+  n = kfreepages();
+  bcache.maxgroup = n / 4;
+  if(bcache.maxgroup > NGROUP)
+    bcache.maxgroup = NGROUP;
+  n = n / 16;
+  if(n < (NBUF + BPG - 1) / BPG)
+    n = (NBUF + BPG - 1) / BPG;
+  while(n-- > 0){
+    if(bgrow() < 0)
+      panic("binit");
+  }
+}
+
+// Try to recycle buffer b, which the CLOCK hand has
+// reached, for block (dev, blockno) in bucket h.
+// Returns the buffer to use, with refcnt incremented:
+// b itself, or the cached copy of the block if another
+// process got it into bucket h first. Returns 0 if b is
+// in use; the bucket locks are released in all cases.
+static struct buf*
+brecycle(struct buf *b, uint dev, uint blockno, int h)
+{
+  struct buf *cached;
+  int old = b->bucket;
+  int lo, hi;
 
-  initlock(&bcache.lock, "bcache");
+  if(old < 0)
+    return 0;
+  lo = old < h ? old : h;
+  hi = old < h ? h : old;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  acquire(&bcache.bucket[lo].lock);
+  if(hi != lo)
+    acquire(&bcache.bucket[hi].lock);
+
+  if((cached = bucket_find(h, dev, blockno)) != 0){
+    cached->refcnt++;
+    touch(cached);
+    b = cached;
+  } else if(b->bucket != old || b->refcnt != 0 || b->hot){
+    // b changed while we weren't holding the lock.
+    b = 0;
+  } else {
+    bucket_remove(b);
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refcnt = 1;
+    b->recent = 1;
+    bucket_insert(h, b);
   }
+
+  if(hi != lo)
+    release(&bcache.bucket[hi].lock);
+  release(&bcache.bucket[lo].lock);
+  return b;
+}
+
+// Return the buffer at CLOCK position i, or 0.
+static struct buf*
+clockbuf(uint i)
+{
+  int n = bcache.ngroup;
+  struct bgroup *g;
+
+  if(n == 0)
+    return 0;
+  i %= n * BPG;
+  g = bcache.group[i / BPG];
+  if(g == 0 || g->page == 0)
+    return 0;
+  return &g->buf[i % BPG];
+}
+
+// Sweep the CLOCK hand to an unused cold buffer that hasn't
+// been used since the hand last passed it, and recycle it for
+// (dev, blockno). The unlocked checks are only hints;
+// brecycle() checks again under the bucket locks.
+static struct buf*
+bevict(uint dev, uint blockno, int h)
+{
+  struct buf *b;
+  int i, n, old;
+
+  n = 3 * bcache.ngroup * BPG;
+  for(i = 0; i < n; i++){
+    b = clockbuf(__sync_fetch_and_add(&bcache.hand, 1));
+    if(b == 0 || b->refcnt != 0)
+      continue;
+    if(b->recent){
+      b->recent = 0;
+      continue;
+    }
+    if(b->hot){
+      // Demote only while too much of the cache is hot.
+      if(bcache.nhot * 100 <= bcache.npages * BPG * HOTPCT)
+        continue;
+      if((old = b->bucket) < 0)
+        continue;
+      acquire(&bcache.bucket[old].lock);
+      if(b->bucket == old && b->refcnt == 0)
+        setcold(b);
+      release(&bcache.bucket[old].lock);
+      continue;
+    }
+    if((b = brecycle(b, dev, blockno, h)) != 0)
+      return b;
+  }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +350,88 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  int h = BHASH(dev, blockno);
 
-  acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bucket_find(h, dev, blockno)) != 0){
+    b->refcnt++;
+    touch(b);
+    release(&bcache.bucket[h].lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bcache.bucket[h].lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Grow the cache if it's still small and
+  // memory is plentiful, otherwise recycle a buffer. If every buffer is in
+  // use, grow past the limit rather than give up.
+  if(bcache.npages < bcache.maxgroup && kfreepages() > bcache.maxgroup)
+    bgrow();
+  if((b = bevict(dev, blockno, h)) == 0){
+    if(bgrow() < 0 || (b = bevict(dev, blockno, h)) == 0)
+      panic("bget: no buffers");
+  }
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Give up to n pages of unused buffers back to the page
+// allocator, keeping at least NBUF buffers. Groups with
+// hot buffers go last. Called by kalloc() when memory
+// runs out. Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct bgroup *g;
+  struct buf *b;
+  char *pa, *freelist = 0;
+  int i, h, pass, busy, hot, freed = 0;
+
+  acquire(&bcache.growlock);
+
+  // Rare, so simply lock every bucket, in order.
+  for(h = 0; h < NBUCKET; h++)
+    acquire(&bcache.bucket[h].lock);
+
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < bcache.ngroup && freed < n; i++){
+      if((bcache.npages - 1) * BPG < NBUF)
+        break;
+      g = bcache.group[i];
+      if(g->page == 0)
+        continue;
+      busy = hot = 0;
+      for(b = g->buf; b < g->buf + BPG; b++){
+        busy |= b->refcnt != 0;
+        hot |= b->hot;
+      }
+      if(busy || (hot && pass == 0))
+        continue;
+      for(b = g->buf; b < g->buf + BPG; b++){
+        setcold(b);
+        bucket_remove(b);
+        b->data = 0;
+      }
+      // Chain the page for kfree() below.
+      *(char**)g->page = freelist;
+      freelist = g->page;
+      g->page = 0;
+      bcache.npages--;
+      freed++;
     }
   }
-  panic("bget: no buffers");
+
+  for(h = NBUCKET - 1; h >= 0; h--)
+    release(&bcache.bucket[h].lock);
+  release(&bcache.growlock);
+
+  while((pa = freelist) != 0){
+    freelist = *(char**)pa;
+    kfree(pa);
+  }
+  return freed;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +448,44 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading block (dev, blockno) into the cache, if it
+// isn't there already, without waiting for the disk.
+// A later bread() of the block waits for the buffer lock,
+// which bdone() releases when the read completes.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+  int h = BHASH(dev, blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  b = bucket_find(h, dev, blockno);
+  release(&bcache.bucket[h].lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return;
+  }
+  virtio_disk_start(VIRTIO0_ID, b, 0);
+}
+
+// Called by the disk interrupt handler when an I/O started
+// with virtio_disk_start() has finished. Does the work of
+// brelse() on behalf of the process that started it.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+
+  acquire(&bcache.bucket[b->bucket].lock);
+  b->refcnt--;
+  release(&bcache.bucket[b->bucket].lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +495,53 @@ bwrite(struct buf *b)
   virtio_disk_rw(VIRTIO0_ID, b, 1);
 }
 
+// Return a locked buf for block (dev, blockno) without reading
+// it from disk. The caller must overwrite all of b->data.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Write the n locked bufs in bs[] to disk as one batch.
+// If to is not 0, bs[i]'s contents go to block to[i]
+// instead of its own; the cache is not changed.
+void
+bwritev(struct buf **bs, uint *to, int n)
+{
+  // stand-ins for writes to other blocks. Only logd writes
+  // with to set, one commit at a time, so one set suffices.
+  static struct buf tmp[NBATCH];
+  struct buf *v[NBATCH];
+  int i;
+
+  if(n > NBATCH)
+    panic("bwritev: too many");
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    v[i] = bs[i];
+  }
+
+  if(to){
+    for(i = 0; i < n; i++){
+      tmp[i].dev = bs[i]->dev;
+      tmp[i].blockno = to[i];
+      tmp[i].data = bs[i]->data;
+      v[i] = &tmp[i];
+    }
+  }
+
+  virtio_disk_rwv(VIRTIO0_ID, v, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// A buffer in use can't move between buckets,
+// so b->bucket is stable here.
 void
 brelse(struct buf *b)
 {
@@ -121,33 +550,23 @@ brelse(struct buf *b)
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  acquire(&bcache.bucket[b->bucket].lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  release(&bcache.bucket[b->bucket].lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  acquire(&bcache.bucket[b->bucket].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[b->bucket].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  acquire(&bcache.bucket[b->bucket].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.bucket[b->bucket].lock);
 }
 
 
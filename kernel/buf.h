@@ -5,8 +5,11 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int recent;  // used since the CLOCK hand last passed?
+  int hot;     // re-referenced, so kept over cold buffers
+  int bucket;  // hash bucket holding this buf, or -1
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data; // BSIZE bytes
 };
 
@@ -16,8 +16,13 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     boverwrite(uint, uint);
+void            bwritev(struct buf**, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
+void            bprefetch(uint, uint);
+void            bdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -26,25 +31,32 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             pagein(struct proc*, uint64);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
-int             fileread(struct file*, uint64, int n);
+int             fileread(struct file*, int, uint64, int n);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepwrite(struct file*, uint64, int n, uint);
 int             filestat(struct file*, uint64 addr);
-int             filewrite(struct file*, uint64, int n);
+int             filewrite(struct file*, int, uint64, int n);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+int             dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
+int             iputblocks(void);
+void            itext(struct inode*, int);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -52,6 +64,8 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
+struct buf*     ibread(struct inode*, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -64,19 +78,42 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kdup(void *);
+int             krefs(void *);
+int             kunshare(void *);
+void            ksetdirty(void *);
+int             ktakedirty(void *);
 void            kinit(void);
+int             kfreepages(void);
+
+// kmalloc.c
+void*           kmalloc(uint);
+void            kmfree(void *);
+void            kmallocinit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
+int             log_maxop(void);
 void            end_op(void);
+void            logtick(void);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             msync(uint64, uint64);
+int             vmfault(struct proc*, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaclose(struct proc*, int);
+uint64          vmabase(struct proc*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -103,6 +140,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -125,8 +163,17 @@ void            pop_off(void);
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
+int             holdingsleepshared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// raiddev.c
+void            raiddevinit(void);
+
+// splice.c
+int             splice(struct file*, uint64, struct file*, uint64, uint64);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -137,6 +184,7 @@ int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 char*           strcat(char*, const char*);
 void            itoa(int, int, char*);
+void            membench(void);
 
 // syscall.c
 void            argint(int, int*);
@@ -170,6 +218,10 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64, int);
+uint64          uvmshare(pagetable_t, uint64);
+int             uvmreplace(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -177,6 +229,7 @@ pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
+uint64          useraddr(pagetable_t, uint64, uint64, int);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
 // plic.c
@@ -188,6 +241,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(int id, char* name);
 void            virtio_disk_rw(int id, struct buf *, int);
+void            virtio_disk_rwv(int id, struct buf **, int, int);
+void            virtio_disk_start(int id, struct buf *, int);
 void            virtio_disk_intr(int id);
 void            write_block(int diskn, int blockno, uchar* data);
 void            read_block(int diskn, int blockno, uchar* data);
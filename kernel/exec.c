@@ -6,6 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -23,11 +26,12 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -37,7 +41,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -61,6 +65,24 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > TRAPFRAME)
+      goto bad;
+    if(nseg < NSEG){
+      // leave it to pagein() to read the pages that get used.
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].perm = flags2perm(ph.flags);
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    // loaded now, so it must lie above the segments so far,
+    // some of which may not be mapped until pagein().
+    if(ph.vaddr < sz)
+      goto bad;
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -68,8 +90,12 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // keep a reference to the executable for pagein(),
+  // which also keeps it from being changed.
+  itext(ip, 1);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -121,12 +147,23 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaclose(p, 1);
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    itext(oldexe, -1);
+    begin_opn(iputblocks());
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,9 +174,71 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    itext(exe, -1);
+    begin_opn(iputblocks());
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
+// Demand paging: fill in page va of p's image or heap,
+// below p->sz, when it is first touched. Pages of the
+// executable's loadable segments are read from it, and
+// all others are zero-filled.
+// Returns 0 on success, -1 if va is already mapped or
+// memory is exhausted.
+int
+pagein(struct proc *p, uint64 va)
+{
+  struct seg *sg;
+  pte_t *pte;
+  char *mem;
+  uint64 n;
+  int perm = PTE_W, held, r;
+
+  va = PGROUNDDOWN(va);
+  if(va >= p->sz)
+    return -1;
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  for(sg = p->seg; sg < &p->seg[p->nseg]; sg++){
+    if(va < sg->va || va >= sg->va + sg->memsz)
+      continue;
+    perm = sg->perm;
+    if(va - sg->va < sg->filesz){
+      n = sg->filesz - (va - sg->va);
+      if(n > PGSIZE)
+        n = PGSIZE;
+      // the fault may come from copyin() or copyout() in a
+      // write() or read() of the executable, which holds its
+      // lock already, exclusive or shared.
+      held = holdingsleep(&p->exe->lock) || holdingsleepshared(&p->exe->lock);
+      if(!held)
+        ilockshared(p->exe);
+      r = readi(p->exe, 0, (uint64)mem, sg->off + (va - sg->va), n);
+      if(!held)
+        iunlock(p->exe);
+      if(r != n){
+        kfree(mem);
+        return -1;
+      }
+    }
+    break;
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
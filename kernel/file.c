@@ -76,7 +76,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    begin_opn(iputblocks());
     iput(ff.ip);
     end_op();
   }
@@ -91,7 +91,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -101,10 +101,47 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Called after reading n bytes of f at f->off, with
+// f->ip locked. If the reads of f are sequential, start
+// reading the blocks that come next, doubling the window
+// on every sequential read up to MAXREADAHEAD blocks.
+static void
+readahead(struct file *f, int n)
+{
+  uint bn, end;
+
+  if(f->off != f->ranext){
+    // Random access; start over.
+    f->rawin = 0;
+    f->raend = 0;
+  } else if(f->rawin == 0){
+    f->rawin = MINREADAHEAD;
+  } else if(f->rawin < MAXREADAHEAD){
+    f->rawin *= 2;
+    if(f->rawin > MAXREADAHEAD)
+      f->rawin = MAXREADAHEAD;
+  }
+  f->ranext = f->off + n;
+  if(f->rawin == 0)
+    return;
+
+  // Start at the block the next read begins in, or where
+  // the previous read-ahead left off.
+  bn = f->ranext / BSIZE;
+  end = bn + f->rawin;
+  if(f->raend > bn)
+    bn = f->raend;
+  if(bn < end){
+    ireadahead(f->ip, bn, end - bn);
+    f->raend = end;
+  }
+}
+
 // Read from file f.
-// addr is a user virtual address.
+// If user_dst==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-fileread(struct file *f, uint64 addr, int n)
+fileread(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,15 +149,31 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+    if(f->major < 0 || f->major >= NDEV)
+      return -1;
+    if(devsw[f->major].pread){
+      if((r = devsw[f->major].pread(user_dst, addr, f->off, n)) > 0)
+        f->off += r;
+      return r;
+    }
+    if(!devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    // f->off and the read-ahead state belong to f, so
+    // readers can share the inode only if f is not shared.
+    // A process can't dup f while it is in read(), so
+    // f->ref == 1 stays true until we're done.
+    if(f->ref == 1)
+      ilockshared(f->ip);
+    else
+      ilock(f->ip);
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0){
+      readahead(f, r);
       f->off += r;
+    }
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,50 +182,68 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Write n bytes to inode ip at byte offset *off,
+// and advance *off. Returns n, or -1.
+static int
+inodewrite(struct inode *ip, int user_src, uint64 addr, int n, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, double-indirect block, two leaf indirect
+  // blocks, allocation blocks, and 2 blocks of slop
+  // for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((log_maxop()-1-3-2) / 2) * BSIZE;
+  int i = 0, r;
+
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_opn(2*(n1/BSIZE) + 1+3+2);
+    ilock(ip);
+    if ((r = writei(ip, user_src, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_op();
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
-// addr is a user virtual address.
+// If user_src==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewrite(struct file *f, int user_src, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+    if(f->major < 0 || f->major >= NDEV)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
+    if(devsw[f->major].pwrite){
+      if((ret = devsw[f->major].pwrite(user_src, addr, f->off, n)) > 0)
+        f->off += ret;
+      return ret;
     }
-    ret = (i == n ? n : -1);
+    if(!devsw[f->major].write)
+      return -1;
+    ret = devsw[f->major].write(user_src, addr, n);
+  } else if(f->type == FD_INODE){
+    ret = inodewrite(f->ip, user_src, addr, n, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +251,45 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read n bytes at byte offset off of file f into user
+// address addr, without using or moving f->off, so that
+// processes sharing f can't move each other's reads.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].pread)
+      return -1;
+    return devsw[f->major].pread(1, addr, off, n);
+  }
+  if(f->type != FD_INODE)
+    return -1;
+  // f's state isn't touched, so the lock can be shared.
+  ilockshared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Write n bytes from user address addr at byte offset off
+// of file f, without using or moving f->off.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].pwrite)
+      return -1;
+    return devsw[f->major].pwrite(1, addr, off, n);
+  }
+  if(f->type != FD_INODE)
+    return -1;
+  return inodewrite(f->ip, 1, addr, n, &off);
+}
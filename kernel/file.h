@@ -7,6 +7,9 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  uint ranext;       // FD_INODE: offset a sequential read would start at
+  uint rawin;        // FD_INODE: read-ahead window in blocks, 0 if not sequential
+  uint raend;        // FD_INODE: first block not yet read ahead
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +21,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *fprev; // itable free list, if ref is 0
+  struct inode *fnext;
+  int text;           // Processes running it; see itext()
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,15 +33,24 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  struct spinlock maplock;
+  uint *map;          // copy of leaf indirect block mapleaf
+  int mapleaf;        // or -1
+  uint goal;          // where to look for the next free block
 };
 
 // map major device number to device functions.
+// a device with pread/pwrite is seekable: they get
+// the file offset, and read/write are not used.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*pread)(int, uint64, uint, int);
+  int (*pwrite)(int, uint64, uint, int);
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define RAIDDEV 2
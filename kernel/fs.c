@@ -52,7 +52,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = boverwrite(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -60,26 +60,67 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Where the next search for a free block starts when
+// the caller has no goal. There is one file system
+// device (sb is global too), so one hint suffices.
+// Updated without a lock: it is only a hint.
+static uint allochint;
+
+// Index of the lowest zero bit in w, which must not be all ones.
+static int
+ffz(uint64 w)
+{
+  int n = 0;
+
+  w = ~w;
+  if((w & 0xffffffff) == 0){ n += 32; w >>= 32; }
+  if((w & 0xffff) == 0){ n += 16; w >>= 16; }
+  if((w & 0xff) == 0){ n += 8; w >>= 8; }
+  if((w & 0xf) == 0){ n += 4; w >>= 4; }
+  if((w & 0x3) == 0){ n += 2; w >>= 2; }
+  if((w & 0x1) == 0){ n += 1; }
+  return n;
+}
+
+// Allocate a zeroed disk block, the first free one at or
+// after goal (or the allocation hint if goal is 0), wrapping
+// around to the start of the disk.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  uint b, bi, wi, nbmap, from, n;
+  uint64 w, *map;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal == 0 || goal >= sb.size)
+    goal = allochint;
+  if(goal >= sb.size)
+    goal = 0;
+  nbmap = (sb.size + BPB - 1) / BPB;
+
+  // Visit goal's bitmap block, the rest, and then goal's
+  // again for the bits before goal.
+  for(n = 0; n <= nbmap; n++){
+    b = (goal / BPB + n) % nbmap * BPB;
+    from = (n == 0) ? goal % BPB : 0;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    map = (uint64*)bp->data;
+    for(wi = from / 64; wi < BPB / 64 && b + wi*64 < sb.size; wi++){
+      w = map[wi];
+      if(wi == from / 64)
+        w |= ((uint64)1 << (from % 64)) - 1;  // skip bits before from
+      if(w == ~(uint64)0)
+        continue;
+      bi = wi*64 + ffz(w);
+      if(b + bi >= sb.size)
+        break;
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      bzero(dev, b + bi);
+      allochint = b + bi + 1;
+      return b + bi;
     }
     brelse(bp);
   }
@@ -134,7 +175,10 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. Entries are hashed by (dev, inum);
+//   a free entry stays in its chain, on an LRU free list,
+//   until iget() recycles it, so iget() of a recently
+//   used inode finds it still valid.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -144,7 +188,9 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. Code that only examines
+//   them may use ilockshared() instead of ilock(), which
+//   lets other readers hold the lock at the same time.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -167,17 +213,71 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, or the hash and free list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Shared holders may both fill ip->map, so ip->maplock
+// protects it and ip->mapleaf.
+
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *free;   // least recently used free entry
+  struct inode *last;   // most recently used free entry
 } itable;
 
+// Append ip to the free list. Caller holds itable.lock.
+static void
+ifree_put(struct inode *ip)
+{
+  ip->fnext = 0;
+  ip->fprev = itable.last;
+  if(itable.last)
+    itable.last->fnext = ip;
+  else
+    itable.free = ip;
+  itable.last = ip;
+}
+
+// Take ip off the free list. Caller holds itable.lock.
+static void
+ifree_remove(struct inode *ip)
+{
+  if(ip->fprev)
+    ip->fprev->fnext = ip->fnext;
+  else
+    itable.free = ip->fnext;
+  if(ip->fnext)
+    ip->fnext->fprev = ip->fprev;
+  else
+    itable.last = ip->fprev;
+  ip->fprev = ip->fnext = 0;
+}
+
+// Take ip out of its hash chain. Caller holds itable.lock.
+static void
+ihash_remove(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->hnext = 0;
+}
+
+static void dcacheinit(void);
+
 void
 iinit()
 {
@@ -186,10 +286,14 @@ iinit()
   initlock(&itable.lock, "itable");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    initlock(&itable.inode[i].maplock, "inode map");
+    ifree_put(&itable.inode[i]);
   }
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcache_purge(uint dev, uint dir);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -246,31 +350,36 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ifree_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  if((ip = itable.free) == 0)
     panic("iget: no inodes");
+  ifree_remove(ip);
+  if(ip->dev)
+    ihash_remove(ip);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->mapleaf = -1;
+  ip->goal = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -316,14 +425,60 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared with other readers,
+// who may examine but not modify it.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  while(ip->valid == 0){
+    // Read it from disk under the exclusive lock.
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    releasesleep(&ip->lock);
+    acquiresleepshared(&ip->lock);
+  }
+}
+
+// Unlock the given inode, locked by either
+// ilock() or ilockshared().
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  if(holdingsleep(&ip->lock))
+    releasesleep(&ip->lock);
+  else if(holdingsleepshared(&ip->lock))
+    releasesleepshared(&ip->lock);
+  else
+    panic("iunlock");
+}
+
+// Count one more (n = 1) or one fewer (n = -1) process
+// running ip as its executable. While any does, writei()
+// and O_TRUNC fail, so that pagein() reads the same bytes
+// exec() checked. exec() counts up while it holds ip->lock,
+// so no write is under way; fork() copies a count that is
+// already positive.
+void
+itext(struct inode *ip, int n)
+{
+  __sync_fetch_and_add(&ip->text, n);
+}
+
+// Most blocks iput() can write when it frees an inode:
+// the inode's own block and every bitmap block. Callers
+// that may drop the last reference to an unlinked inode
+// reserve this much with begin_opn().
+int
+iputblocks(void)
+{
+  return 1 + (sb.size + BPB - 1) / BPB;
 }
 
 // Drop a reference to an in-memory inode.
@@ -347,6 +502,8 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -358,6 +515,8 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0)
+    ifree_put(ip);
   release(&itable.lock);
 }
 
@@ -374,20 +533,81 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after that are listed in the NINDIRECT leaf blocks listed
+// in block ip->addrs[NDIRECT+1].
+//
+// Blocks that list data blocks are leaves: leaf 0 is
+// ip->addrs[NDIRECT], leaf 1+k is the k'th block under
+// ip->addrs[NDIRECT+1]. ip->map caches a copy of the leaf
+// used last, so sequential access reads each leaf once.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
+// Allocate a block for ip, next to the one it got last
+// so that a file written in order is laid out in order.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  if((addr = balloc(ip->dev, ip->goal)) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
+
+// Return the address of leaf li, allocating it if alloc
+// is set. Returns 0 if out of disk space, or if there is
+// no such leaf and alloc is clear.
 static uint
-bmap(struct inode *ip, uint bn)
+leafaddr(struct inode *ip, uint li, int alloc)
 {
   uint addr, *a;
   struct buf *bp;
 
+  if(li == 0){
+    if((addr = ip->addrs[NDIRECT]) == 0 && alloc){
+      addr = iballoc(ip);
+      ip->addrs[NDIRECT] = addr;
+    }
+    return addr;
+  }
+
+  // Load double-indirect block, allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+1]) == 0){
+    if(!alloc)
+      return 0;
+    addr = iballoc(ip);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+1] = addr;
+  }
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[li-1]) == 0 && alloc){
+    addr = iballoc(ip);
+    if(addr){
+      a[li-1] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block and alloc is set, bmap allocates one.
+// returns 0 if out of disk space, or if there is no such block
+// and alloc is clear.
+static uint
+bmap(struct inode *ip, uint bn, int alloc)
+{
+  uint addr, li, *a, *map;
+  struct buf *bp;
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      if(!alloc)
+        return 0;
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,28 +616,66 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+  if(bn >= NINDIRECT + NDINDIRECT)
+    panic("bmap: out of range");
+  li = bn / NINDIRECT;
+  bn %= NINDIRECT;
+
+  if(ip->map){
+    acquire(&ip->maplock);
+    addr = ip->mapleaf == li ? ip->map[bn] : 0;
+    release(&ip->maplock);
+    if(addr)
+      return addr;
+  }
+
+  if((addr = leafaddr(ip, li, alloc)) == 0)
+    return 0;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0 && alloc){
+    addr = iballoc(ip);
+    if(addr){
+      a[bn] = addr;
+      log_write(bp);
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+  }
+  if(ip->map == 0 && (map = kmalloc(BSIZE)) != 0){
+    acquire(&ip->maplock);
+    if(ip->map == 0){
+      ip->map = map;
+      map = 0;
     }
-    brelse(bp);
-    return addr;
+    release(&ip->maplock);
+    if(map)
+      kmfree(map);
+  }
+  if(ip->map){
+    acquire(&ip->maplock);
+    memmove(ip->map, a, BSIZE);
+    ip->mapleaf = li;
+    release(&ip->maplock);
   }
+  brelse(bp);
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free the blocks listed in leaf addr, then the leaf.
+static void
+freeleaf(struct inode *ip, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -437,17 +695,23 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    freeleaf(ip, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        freeleaf(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
+  ip->mapleaf = -1;
   ip->size = 0;
   iupdate(ip);
 }
@@ -465,7 +729,8 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, possibly shared,
+// so readi() never allocates blocks.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
@@ -480,7 +745,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 0);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -495,6 +760,36 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading blocks bn .. bn+n-1 of ip into the buffer
+// cache without waiting, stopping at the end of the file.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint addr, last;
+
+  if(ip->size == 0)
+    return;
+  last = (ip->size - 1) / BSIZE;
+  for(; n > 0 && bn <= last && bn < MAXFILE; n--, bn++){
+    if((addr = bmap(ip, bn, 0)) == 0)
+      break;
+    bprefetch(ip->dev, addr);
+  }
+}
+
+// Return a locked buffer holding block bn of ip, or 0 if
+// ip has no such block. Caller must hold ip->lock.
+struct buf*
+ibread(struct inode *ip, uint bn)
+{
+  uint addr;
+
+  if(bn >= MAXFILE || (addr = bmap(ip, bn, 0)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -512,9 +807,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->text > 0)
+    return -1;  // a running program is paged in from ip
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 1);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -546,6 +843,154 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory lookup cache.
+//
+// The dcache remembers the results of dirlookup(): for a
+// name in directory (dev, dir), either the entry's inum
+// and offset, or that the name is absent (inum 0). Entries
+// are hashed by (dev, dir, name) into NDHASH chains and
+// replaced by CLOCK.
+//
+// The directory's inode lock orders cache updates with the
+// directory's contents: dirlookup(), dirlink() and
+// dirunlink() all run with dp locked, and the latter two
+// update the cache along with the directory. iput() drops
+// a freed directory's entries before its inum is reused.
+
+#define NDENTRY 256
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;         // inum of the directory
+  char name[DIRSIZ];
+  uint inum;        // 0 if name is not in dir
+  uint off;         // byte offset of the entry if inum != 0
+  char used;
+  char recent;      // hit since the clock hand last passed
+  struct dentry *next; // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  uint hand;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name, uint h)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[h]; d; d = d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->used = 0;
+}
+
+// Look up name in dp in the cache. Returns 1 and sets *inum
+// (0 if the name is known to be absent) and *off on a hit.
+static int
+dcache_lookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int hit = 0;
+
+  acquire(&dcache.lock);
+  d = dfind(dp->dev, dp->inum, name, dhash(dp->dev, dp->inum, name));
+  if(d){
+    d->recent = 1;
+    *inum = d->inum;
+    *off = d->off;
+    hit = 1;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+// Record that name in dp is inum at offset off,
+// or absent if inum is 0.
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h = dhash(dp->dev, dp->inum, name);
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name, h)) == 0){
+    // Recycle the first entry the clock hand finds
+    // that hasn't been used since it last passed.
+    for(;;){
+      d = &dcache.dentry[dcache.hand++ % NDENTRY];
+      if(!d->used)
+        break;
+      if(!d->recent){
+        dunhash(d);
+        break;
+      }
+      d->recent = 0;
+    }
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->used = 1;
+    d->recent = 0;
+    d->next = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory (dev, dir).
+static void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++)
+    if(d->used && d->dev == dev && d->dir == dir)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -557,6 +1002,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcache_lookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1020,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcache_enter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcache_enter(dp, name, 0, 0);
   return 0;
 }
 
@@ -601,6 +1056,22 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum, off);
+
+  return 0;
+}
+
+// Clear the directory entry for name at byte offset off
+// in the directory dp. Returns 0 on success, -1 on failure.
+int
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  dcache_enter(dp, name, 0, 0);
 
   return 0;
 }
@@ -659,7 +1130,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
@@ -1,6 +1,26 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps a small cache of free pages so that most
+// kalloc()/kfree() calls don't touch the global kmem.lock.
+// A CPU refills its cache from the global list, and drains
+// it back, KBATCH pages at a time. If the global list runs
+// dry, kalloc() steals from the other CPUs' caches.
+//
+// Pages are reference counted so that fork() can share them
+// copy-on-write: kalloc() returns a page with one reference,
+// kdup() adds one, and kfree() drops one and frees the page
+// only when none are left.
+//
+// A page of a MAP_SHARED mapping that several processes map
+// after fork() also carries a dirty mark: a process that
+// unmaps it while others still map it leaves its changes to
+// the last one, which writes the page back (see mmap.c).
+//
+// Build with KALLOC_JUNK=1 to fill pages with junk on
+// kalloc() and kfree(), to catch uninitialized use and
+// dangling references.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +29,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KCACHE 64   // max pages cached per CPU
+#define KBATCH 32   // pages moved per refill/drain
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -21,12 +44,29 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int n;
 } kmem;
 
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kcache[NCPU];
+
+// Reference count of each physical page.
+static int kref[(PHYSTOP - KERNBASE) / PGSIZE];
+#define KREF(pa) kref[((uint64)(pa) - KERNBASE) / PGSIZE]
+
+// Dirty mark of each physical page.
+static int kdirty[(PHYSTOP - KERNBASE) / PGSIZE];
+#define KDIRTY(pa) kdirty[((uint64)(pa) - KERNBASE) / PGSIZE]
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,33 +75,179 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    KREF(p) = 1;
     kfree(p);
+  }
+}
+
+// Lock and return this CPU's page cache.
+static int
+kcache_lock(void)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kcache[id].lock);
+  pop_off();
+  return id;
+}
+
+// Add a reference to page pa, which must be allocated.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&KREF(pa), 1);
+}
+
+// Number of references to page pa.
+int
+krefs(void *pa)
+{
+  return KREF(pa);
+}
+
+// Drop a reference to page pa unless it is the last one.
+// Returns 1 if it dropped one, or 0 if the caller holds the
+// only reference, which it must kfree() itself.
+int
+kunshare(void *pa)
+{
+  int n;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kunshare");
+  do {
+    if((n = KREF(pa)) <= 1)
+      return 0;
+  } while(!__sync_bool_compare_and_swap(&KREF(pa), n, n - 1));
+  return 1;
+}
+
+// Mark page pa dirty.
+void
+ksetdirty(void *pa)
+{
+  __sync_lock_test_and_set(&KDIRTY(pa), 1);
+}
+
+// Clear page pa's dirty mark; return whether it was set.
+int
+ktakedirty(void *pa)
+{
+  return __sync_lock_test_and_set(&KDIRTY(pa), 0);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free the page if it was the last.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *first, *last;
+  int id, i, n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&KREF(pa), 1);
+  if(n < 0)
+    panic("kfree: not allocated");
+  if(n > 0)
+    return;
+  KDIRTY(pa) = 0;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
+  id = kcache_lock();
+  r->next = kcache[id].freelist;
+  kcache[id].freelist = r;
+  kcache[id].n++;
+
+  if(kcache[id].n <= KCACHE){
+    release(&kcache[id].lock);
+    return;
+  }
+
+  // Cache is full; hand a batch back to the global list.
+  first = last = kcache[id].freelist;
+  for(i = 1; i < KBATCH; i++)
+    last = last->next;
+  kcache[id].freelist = last->next;
+  kcache[id].n -= KBATCH;
+  release(&kcache[id].lock);
+
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  last->next = kmem.freelist;
+  kmem.freelist = first;
+  kmem.n += KBATCH;
   release(&kmem.lock);
 }
 
+// Move up to KBATCH pages from the global list into
+// cache id, whose lock the caller holds.
+static void
+krefill(int id)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = kmem.freelist) != 0; i++){
+    kmem.freelist = r->next;
+    kmem.n--;
+    r->next = kcache[id].freelist;
+    kcache[id].freelist = r;
+    kcache[id].n++;
+  }
+  release(&kmem.lock);
+}
+
+// Take one page from some other CPU's cache.
+static struct run*
+ksteal(int id)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    if(i == id || kcache[i].n == 0)
+      continue;
+    acquire(&kcache[i].lock);
+    r = kcache[i].freelist;
+    if(r){
+      kcache[i].freelist = r->next;
+      kcache[i].n--;
+    }
+    release(&kcache[i].lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Number of free pages. Only a snapshot, since
+// other CPUs may be allocating and freeing.
+int
+kfreepages(void)
+{
+  int n = kmem.n;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kcache[i].n;
+  return n;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -69,14 +255,31 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  id = kcache_lock();
+  if(kcache[id].freelist == 0)
+    krefill(id);
+  r = kcache[id].freelist;
+  if(r){
+    kcache[id].freelist = r->next;
+    kcache[id].n--;
+  }
+  release(&kcache[id].lock);
 
+  if(r == 0)
+    r = ksteal(id);
+
+  // Out of memory: ask the buffer cache to give back
+  // some pages, and try once more.
+  if(r == 0 && bshrink(KBATCH) > 0)
+    return kalloc();
+
+  if(r)
+    KREF(r) = 1;
+#ifdef KALLOC_JUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
@@ -0,0 +1,160 @@
+// Small-object allocator, for kernel structures that are
+// much smaller than a page (RAID block buffers, virtio
+// transfer buffers, ...). Built on kalloc().
+//
+// Objects come in power-of-two size classes from 16 bytes
+// to 2048 bytes. A slab is one page from kalloc() cut into
+// objects of a single class; pgclass[] records the class of
+// every slab page so that kmfree() needs no size argument.
+//
+// Each CPU keeps a magazine of free objects per class, used
+// with interrupts off and no lock. Magazines are refilled
+// from, and flushed to, a per-class depot under its lock,
+// half a magazine at a time. Slab pages are not returned
+// to kalloc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define KMIN    16    // smallest object size
+#define NCLASS  8     // 16, 32, ..., 2048 bytes
+#define KMAG    16    // objects per CPU magazine
+
+struct obj {
+  struct obj *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct obj *freelist;
+  int npages;       // slab pages owned by this class
+} depot[NCLASS];
+
+struct magazine {
+  int n;
+  void *obj[KMAG];
+};
+
+struct magazine mags[NCPU][NCLASS];
+
+// 1 + size class of each physical page, or 0 if not a slab.
+static uchar pgclass[(PHYSTOP - KERNBASE) / PGSIZE];
+
+void
+kmallocinit(void)
+{
+  for(int i = 0; i < NCLASS; i++)
+    initlock(&depot[i].lock, "kmalloc");
+}
+
+static int
+sizeclass(uint n)
+{
+  int c;
+  uint sz = KMIN;
+
+  for(c = 0; c < NCLASS; c++, sz <<= 1)
+    if(n <= sz)
+      return c;
+  return -1;
+}
+
+// Cut a fresh page into objects of class c and add
+// them to the depot. Caller holds depot[c].lock.
+static int
+slabgrow(int c)
+{
+  char *pa, *o;
+  uint sz = KMIN << c;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  pgclass[((uint64)pa - KERNBASE) / PGSIZE] = c + 1;
+  for(o = pa; o + sz <= pa + PGSIZE; o += sz){
+    ((struct obj*)o)->next = depot[c].freelist;
+    depot[c].freelist = (struct obj*)o;
+  }
+  depot[c].npages++;
+  return 0;
+}
+
+// Move up to KMAG/2 objects from the depot into m.
+static void
+magfill(struct magazine *m, int c)
+{
+  struct obj *o;
+
+  acquire(&depot[c].lock);
+  if(depot[c].freelist == 0)
+    slabgrow(c);
+  while(m->n < KMAG/2 && (o = depot[c].freelist) != 0){
+    depot[c].freelist = o->next;
+    m->obj[m->n++] = o;
+  }
+  release(&depot[c].lock);
+}
+
+// Move KMAG/2 objects from m back to the depot.
+static void
+magflush(struct magazine *m, int c)
+{
+  struct obj *o;
+
+  acquire(&depot[c].lock);
+  while(m->n > KMAG/2){
+    o = m->obj[--m->n];
+    o->next = depot[c].freelist;
+    depot[c].freelist = o;
+  }
+  release(&depot[c].lock);
+}
+
+// Allocate n bytes, n <= 2048.
+// Returns 0 if the memory cannot be allocated.
+// The memory is not zeroed.
+void*
+kmalloc(uint n)
+{
+  struct magazine *m;
+  void *p = 0;
+  int c;
+
+  if((c = sizeclass(n)) < 0)
+    panic("kmalloc: too big");
+
+  push_off();
+  m = &mags[cpuid()][c];
+  if(m->n == 0)
+    magfill(m, c);
+  if(m->n > 0)
+    p = m->obj[--m->n];
+  pop_off();
+
+  return p;
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *p)
+{
+  struct magazine *m;
+  uint64 pa = (uint64)p;
+  int c;
+
+  if(pa < KERNBASE || pa >= PHYSTOP)
+    panic("kmfree");
+  c = pgclass[(pa - KERNBASE) / PGSIZE] - 1;
+  if(c < 0 || (pa % (KMIN << c)) != 0)
+    panic("kmfree: not a kmalloc object");
+
+  push_off();
+  m = &mags[cpuid()][c];
+  if(m->n == KMAG)
+    magflush(m, c);
+  m->obj[m->n++] = p;
+  pop_off();
+}
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -16,10 +17,24 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves log space for the
+// blocks the call might write (MAXOPBLOCKS, or a number
+// given to begin_opn()); blocks the call actually logs are
+// taken from its reservation, and end_op() hands back the
+// rest. If the log can't hold the reservation, begin_op()
+// sleeps until the log daemon has committed.
+//
+// The size of the log is chosen by mkfs and recorded
+// in the superblock, up to LOGSIZE data blocks.
+//
+// Commits are grouped: end_op() does not commit, it leaves
+// that to logd, a kernel thread, which commits whatever has
+// accumulated once a clock tick has passed or when the log
+// is close to full. So a system call that returns may not be
+// on disk for up to a tick. After the commit point, logd
+// installs the transaction to the home locations while new
+// FS system calls run; it installs from the log copies, so
+// blocks that the new calls change are not written early.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +43,7 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log blocks are written in batches of NBATCH.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,73 +56,96 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // data blocks the log holds.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // blocks reserved but not yet logged.
   int committing;  // in commit(), please wait.
+  int flush;       // logd should commit when outstanding is 0.
   int dev;
-  struct logheader lh;
+  struct logheader lh;        // transaction being built
+  struct buf *pinned[LOGSIZE]; // cache bufs of lh.block[]
+  struct logheader ckpt;      // committed, being installed by logd
+  struct buf *ckptpinned[LOGSIZE];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog < MAXOPBLOCKS + 1)
+    panic("initlog: log too small");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1;
+  if(log.cap > LOGSIZE)
+    log.cap = LOGSIZE;
   log.dev = dev;
   recover_from_log();
+  kthread("logd", logd);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// and unpin their cache buffers if pinned is not 0.
+// The cache already holds the committed contents (or newer
+// ones), so the log copies go straight to disk.
 static void
-install_trans(int recovering)
+install_trans(struct logheader *lh, struct buf **pinned)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *lbuf[NBATCH];
+  uint home[NBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < lh->n; tail += n) {
+    n = lh->n - tail;
+    if(n > NBATCH)
+      n = NBATCH;
+    for (i = 0; i < n; i++) {
+      lbuf[i] = bread(log.dev, log.start+tail+i+1); // read log block
+      home[i] = lh->block[tail+i];
+    }
+    bwritev(lbuf, home, n);  // write log copies to home locations
+    for (i = 0; i < n; i++) {
+      if(pinned)
+        bunpin(pinned[tail+i]);
+      brelse(lbuf[i]);
+    }
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into lh
 static void
-read_head(void)
+read_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lh->n = hb->n;
+  for (i = 0; i < lh->n; i++) {
+    lh->block[i] = hb->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write a log header to disk.
+// Writing a non-empty header is the true point
+// at which a transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = boverwrite(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  memset(buf->data, 0, BSIZE);
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -116,95 +154,170 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  read_head(&log.ckpt);
+  install_trans(&log.ckpt, 0); // if committed, copy from log to disk
+  log.ckpt.n = 0;
+  write_head(&log.ckpt); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// begin an FS system call that writes at most n blocks.
+void
+begin_opn(int n)
+{
+  struct proc *p = myproc();
+
   acquire(&log.lock);
+  if(n > log.cap)
+    panic("begin_op: too many blocks");
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
+      if(log.outstanding == 0){
+        log.flush = 1;
+        wakeup(&log.flush);
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      p->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Largest reservation begin_opn() should ask for,
+// leaving room for other calls in the same transaction.
+int
+log_maxop(void)
+{
+  if(log.cap / 2 < MAXOPBLOCKS)
+    return MAXOPBLOCKS;
+  return log.cap / 2;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// asks logd to commit if this was the last outstanding
+// operation and either a commit is due or another
+// operation might not fit in the log.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= p->logres;
+  p->logres = 0;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0 && log.lh.n + MAXOPBLOCKS > log.cap)
+    log.flush = 1;
+  if(log.outstanding == 0 && log.flush)
+    wakeup(&log.flush);
+  // begin_op() may be waiting for log space,
+  // and this call's unused reservation is free again.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Called on each clock tick: have logd commit
+// whatever has accumulated.
+void
+logtick(void)
+{
+  if(log.lh.n == 0)
+    return;
+  acquire(&log.lock);
+  if(log.lh.n > 0){
+    log.flush = 1;
+    if(log.outstanding == 0)
+      wakeup(&log.flush);
   }
+  release(&log.lock);
 }
 
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[NBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > NBATCH)
+      n = NBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = boverwrite(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, 0, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
+// Commit the current transaction, then let new FS system
+// calls start while it is installed. Runs in logd, so a
+// commit never overwrites the log before the previous
+// transaction has been installed and erased.
 static void
-commit()
+commit(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  write_log();          // Write modified blocks from cache to log
+  write_head(&log.lh);  // Write header to disk -- the real commit
+
+  acquire(&log.lock);
+  log.ckpt = log.lh;
+  memmove(log.ckptpinned, log.pinned, sizeof(log.pinned));
+  log.lh.n = 0;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  install_trans(&log.ckpt, log.ckptpinned); // Now install writes to home locations
+  log.ckpt.n = 0;
+  write_head(&log.ckpt); // Erase the transaction from the log
+}
+
+// The log daemon: commits transactions on behalf of end_op().
+static void
+logd(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(!log.flush || log.outstanding > 0)
+      sleep(&log.flush, &log.lock);
+    log.flush = 0;
+    if(log.lh.n == 0)
+      continue;
+    log.committing = 1;
+    release(&log.lock);
+
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// logd's commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,10 +327,11 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct proc *p = myproc();
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -229,7 +343,12 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    log.pinned[i] = b;
     log.lh.n++;
+    if(p->logres > 0){  // take it from the reservation
+      p->logres--;
+      log.reserved--;
+    }
   }
   release(&log.lock);
 }
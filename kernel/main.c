@@ -17,6 +17,10 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    kmallocinit();   // small-object allocator
+#ifdef MEMBENCH
+    membench();      // time memmove/memset/memcmp
+#endif
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -29,6 +33,7 @@ main()
     fileinit();      // file table
     virtio_disk_init(VIRTIO0_ID, "program_disk"); // emulated hard disk 0, with programs
     init_raidlock(); // initialize sleeplock used in raid functionsss
+    raiddevinit();   // /dev/raid0
 
     for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++) {
       char name[30] = {0};
@@ -0,0 +1,390 @@
+//
+// Memory-mapped regions.
+//
+// mmap() reserves a range of a process's address space below
+// the trapframe and records it in a struct vma; no memory is
+// allocated until the process touches a page, when usertrap()
+// (or copyin()/copyout()) calls vmfault() to read the page in.
+// A page is mapped read-only until the first store to it, which
+// faults again and marks the PTE dirty, so msync() and munmap()
+// write back only the pages that changed, and only for
+// MAP_SHARED regions.
+//
+// fork() maps the resident pages of a region into the child
+// too. Those of a MAP_SHARED region stay shared, so both see
+// each other's stores; those of a writable MAP_PRIVATE region
+// become copy-on-write, like the rest of memory. The first
+// store through a process's mapping of a shared page marks the
+// page itself dirty with ksetdirty(), as well as the PTE, so
+// an msync() through any mapping writes the change back. A
+// process that unmaps the page while another still maps it
+// leaves the write-back to whoever drops the last mapping.
+//
+// A region maps either an open file, whose pages are read
+// through the buffer cache with readi() and written back with
+// writei() (never past the end of the file), or, with MAP_RAID,
+// the logical RAID volume, whose pages are read and written with
+// read_raid() and write_raid() straight into the mapped page.
+//
+
+#include "raid.h"
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+
+// Find the region of p that contains va.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Lowest address used by p's regions;
+// the heap must stay below it.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Read the page of v at va into mem.
+static int
+vmaread(struct vma *v, uint64 va, char *mem)
+{
+  uint64 off = v->off + (va - v->addr);
+  struct inode *ip;
+  int i, n, held;
+
+  if(v->f){
+    // the fault may come from copyin() or copyout() in a
+    // write() or read() of this same file, which holds the
+    // inode lock already, exclusive or shared. Taking it
+    // shared again would wait behind a waiting writer.
+    ip = v->f->ip;
+    held = holdingsleep(&ip->lock) || holdingsleepshared(&ip->lock);
+    if(!held)
+      ilockshared(ip);
+    n = readi(ip, 0, (uint64)mem, off, PGSIZE);
+    if(!held)
+      iunlock(ip);
+    // the part of the page past the end of the file reads as zeros.
+    if(n < 0)
+      return -1;
+    memset(mem + n, 0, PGSIZE - n);
+    return 0;
+  }
+
+  for(i = 0; i < PGSIZE/BSIZE; i++)
+    if(read_raid(off/BSIZE + i, (uchar*)mem + i*BSIZE) < 0)
+      return -1;
+  return 0;
+}
+
+// Write the page of v at va back from mem.
+static int
+vmawrite(struct vma *v, uint64 va, char *mem)
+{
+  uint64 off = v->off + (va - v->addr);
+  struct inode *ip;
+  int i, n, r;
+
+  if(v->f){
+    // a page is at most 4 data blocks and the inode,
+    // well within one transaction.
+    ip = v->f->ip;
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if(off < ip->size)
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    r = n > 0 ? writei(ip, 0, (uint64)mem, off, n) : 0;
+    iunlock(ip);
+    end_op();
+    return r == n ? 0 : -1;
+  }
+
+  for(i = 0; i < PGSIZE/BSIZE; i++)
+    if(write_raid(off/BSIZE + i, (uchar*)mem + i*BSIZE) < 0)
+      return -1;
+  return 0;
+}
+
+// Handle a page fault at va in p.
+// Returns 0 if the faulting access can be retried,
+// -1 if va isn't mapped for that kind of access.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    // first store to a clean page; a copy-on-write page
+    // is left to uvmcow().
+    if(!write || (*pte & (PTE_W|PTE_COW)))
+      return -1;
+    *pte |= PTE_W | PTE_DIRTY;
+    // other processes mapping the page see it dirty too.
+    if(v->flags & MAP_SHARED)
+      ksetdirty((void*)PTE2PA(*pte));
+    sfence_vma();
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(vmaread(v, va, mem) < 0){
+    kfree(mem);
+    return -1;
+  }
+  perm = PTE_U | PTE_R;
+  if(write)
+    perm |= PTE_W | PTE_DIRTY;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Remove the pages of v from va to va+len, writing
+// dirty pages of a shared region back if writeback is set.
+static int
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len, int writeback)
+{
+  uint64 a, pa;
+  pte_t *pte;
+  int dirty, r = 0;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    dirty = *pte & PTE_DIRTY;
+    *pte = 0;
+    if(v->flags & MAP_SHARED){
+      if(dirty)
+        ksetdirty((void*)pa);
+      // another process still maps the page and will write it back.
+      if(kunshare((void*)pa))
+        continue;
+      if(ktakedirty((void*)pa) && writeback && vmawrite(v, a, (char*)pa) < 0)
+        r = -1;
+    }
+    kfree((void*)pa);
+  }
+  sfence_vma();
+  return r;
+}
+
+// Map len bytes at byte offset off of file f, or of the
+// RAID volume if f is 0 and flags has MAP_RAID, into the
+// current process. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *fv;
+  uint blkn, blks, diskn;
+  uint64 addr;
+
+  if(len == 0 || off % PGSIZE)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  len = PGROUNDUP(len);
+  if(f){
+    if((flags & MAP_RAID) || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    if(off + len > (uint64)MAXFILE * BSIZE)
+      return -1;
+  } else {
+    if((flags & MAP_RAID) == 0)
+      return -1;
+    if(info_raid(&blkn, &blks, &diskn) < 0 || off + len > (uint64)blkn * BSIZE)
+      return -1;
+  }
+
+  fv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0){
+      fv = v;
+      break;
+    }
+  }
+  if(fv == 0)
+    return -1;
+
+  // place the region just below the lowest one.
+  addr = vmabase(p);
+  if(addr < len || addr - len < PGROUNDUP(p->sz))
+    return -1;
+  addr -= len;
+
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->f = f ? filedup(f) : 0;
+  fv->off = off;
+  return addr;
+}
+
+// Unmap len bytes at addr, which must be at the start
+// or the end of a region, so a region stays contiguous.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  int r;
+
+  if(addr % PGSIZE || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmafind(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;
+
+  r = vmaunmap(p, v, addr, len, 1);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    if(v->f)
+      fileclose(v->f);
+    memset(v, 0, sizeof(*v));
+  }
+  return r;
+}
+
+// Write back the dirty pages of a shared region between
+// addr and addr+len, and make them clean again.
+int
+msync(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  int r = 0;
+
+  if(addr % PGSIZE)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmafind(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  if((v->flags & MAP_SHARED) == 0)
+    return 0;
+
+  for(a = addr; a < addr + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    // the page may have been changed through another process's
+    // mapping since it was last written back.
+    if(ktakedirty((void*)PTE2PA(*pte)))
+      *pte |= PTE_DIRTY;
+    if((*pte & PTE_DIRTY) == 0)
+      continue;
+    if(vmawrite(v, a, (char*)PTE2PA(*pte)) < 0){
+      r = -1;
+      continue;
+    }
+    *pte &= ~(PTE_W | PTE_DIRTY);
+  }
+  sfence_vma();
+  return r;
+}
+
+// Give np copies of p's regions, sharing their resident
+// pages: those of MAP_SHARED regions for good, the others
+// copy-on-write, as uvmcopy() does.
+// Called by fork() with np->lock held, so it must not sleep.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 a, pa;
+  pte_t *pte;
+  uint flags;
+  int r = 0;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((v->flags & MAP_SHARED) == 0 && (v->prot & PROT_WRITE))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte);
+      // a shared page keeps its flags, so np's stores are
+      // tracked as dirty too; a private one is never written back.
+      if((v->flags & MAP_SHARED) == 0)
+        flags &= ~PTE_DIRTY;
+      if(mappages(np->pagetable, a, PGSIZE, pa, flags) != 0){
+        r = -1;
+        goto out;
+      }
+      kdup((void*)pa);
+    }
+  }
+ out:
+  sfence_vma();
+  return r;
+}
+
+// Unmap all of p's regions, for exit() and exec(),
+// writing dirty shared pages back if writeback is set.
+void
+vmaclose(struct proc *p, int writeback)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->len, writeback);
+    if(v->f)
+      fileclose(v->f);
+    memset(v, 0, sizeof(*v));
+  }
+}
@@ -7,7 +7,14 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      255  // max data blocks in on-disk log (one header block)
+#define LOGBLOCKS    128  // default on-disk log blocks, set by mkfs -l
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define NBATCH        8  // max blocks in one batched disk write
+#define FSSIZE       70000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MINREADAHEAD 2     // initial read-ahead window, in blocks
+#define MAXREADAHEAD 32    // maximum read-ahead window, in blocks
+#define NVMA         16    // mapped regions per process
+#define NSEG          4    // demand-paged segments per executable
+#define NSHARED       4    // sleep locks one process may hold shared
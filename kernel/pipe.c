@@ -8,11 +8,28 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// A pipe buffers PIPEPAGES pages in a ring, allocated as
+// they are first needed. Readers and writers copy whole runs
+// of bytes with either_copyin()/either_copyout() rather than
+// one at a time,
+// and do so without holding pi->lock, since the copy may take
+// a page fault that sleeps: rlock and wlock keep one reader
+// and one writer at a time, and a writer only touches bytes
+// the reader has finished with, and vice versa.
+//
+// Built with PIPEGIFT=1, a write of a whole, page-aligned
+// user page hands the page itself to the pipe, copy-on-write,
+// and a read of a whole page maps it into the reader the same
+// way, so that neither side copies.
+
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct sleeplock rlock;     // one reader at a time
+  struct sleeplock wlock;     // one writer at a time
+  char *page[PIPEPAGES];      // the ring, or 0 if not allocated yet
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
@@ -28,13 +45,16 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmalloc(sizeof(*pi))) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  initsleeplock(&pi->rlock, "piper");
+  initsleeplock(&pi->wlock, "pipew");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +67,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmfree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -58,6 +78,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -68,63 +90,126 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    for(i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
+    kmfree(pi);
   } else
     release(&pi->lock);
 }
 
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m, err = 0, gift;
+  uint off, room;
+  char **pg, *mem, *old;
   struct proc *pr = myproc();
 
+  acquiresleep(&pi->wlock);
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
+      err = 1;
+      break;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    room = pi->nread + PIPESIZE - pi->nwrite;
+    off = pi->nwrite % PGSIZE;
+    pg = &pi->page[pi->nwrite / PGSIZE % PIPEPAGES];
+    // a slot gets a new page only when all of it is free,
+    // since the reader may still be in its old one.
+    if(room == 0 || ((*pg == 0 || krefs(*pg) > 1) && room < PGSIZE)){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
+    }
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > room)
+      m = room;
+    release(&pi->lock);
+
+    mem = 0;
+    gift = 0;
+#ifdef PIPEGIFT
+    if(user_src && m == PGSIZE && (addr + i) % PGSIZE == 0 && addr + i + PGSIZE <= pr->sz)
+      gift = (mem = (char*)uvmshare(pr->pagetable, addr + i)) != 0;
+#endif
+    if(!gift && (*pg == 0 || krefs(*pg) > 1) && (mem = kalloc()) == 0){
+      acquire(&pi->lock);
+      break;
+    }
+    if(mem){
+      old = *pg;
+      *pg = mem;
+      if(old)
+        kfree(old);
     }
+    if(!gift && either_copyin(*pg + off, user_src, addr + i, m) == -1){
+      acquire(&pi->lock);
+      break;
+    }
+
+    acquire(&pi->lock);
+    pi->nwrite += m;
+    i += m;
+    wakeup(&pi->nread);
   }
   wakeup(&pi->nread);
   release(&pi->lock);
+  releasesleep(&pi->wlock);
 
-  return i;
+  return err ? -1 : i;
 }
 
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
-  int i;
+  int i = 0, m;
+  uint off;
+  char *pg;
   struct proc *pr = myproc();
-  char ch;
 
+  acquiresleep(&pi->rlock);
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
+      releasesleep(&pi->rlock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    off = pi->nread % PGSIZE;
+    pg = pi->page[pi->nread / PGSIZE % PIPEPAGES];
+    m = n - i;
+    if(m > PGSIZE - off)
+      m = PGSIZE - off;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    release(&pi->lock);
+
+#ifdef PIPEGIFT
+    if(user_dst && m == PGSIZE && (addr + i) % PGSIZE == 0 && addr + i + PGSIZE <= pr->sz &&
+       uvmreplace(pr->pagetable, addr + i, (uint64)pg) == 0)
+      goto done;
+#endif
+    if(either_copyout(user_dst, addr + i, pg + off, m) == -1){
+      acquire(&pi->lock);
       break;
+    }
+#ifdef PIPEGIFT
+  done:
+#endif
+    acquire(&pi->lock);
+    pi->nread += m;
+    i += m;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeup(&pi->nwrite);
   release(&pi->lock);
+  releasesleep(&pi->rlock);
   return i;
 }
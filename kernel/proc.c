@@ -48,9 +48,12 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->runq.lock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -89,6 +92,84 @@ myproc(void)
   return p;
 }
 
+// Run queues.
+//
+// Each CPU has its own queue of RUNNABLE processes, so that
+// scheduler() on different harts does not contend on the
+// same locks. A process is queued exactly while it is
+// RUNNABLE: whoever sets p->state = RUNNABLE (holding
+// p->lock) calls runq_put(), and scheduler() takes it off
+// again before marking it RUNNING. An idle CPU steals from
+// the other CPUs' queues.
+//
+// Lock order: p->lock, then runq.lock.
+
+// Mark p RUNNABLE and queue it on the CPU it last ran on,
+// which probably still has its state in cache.
+// Caller must hold p->lock.
+static void
+runq_put(struct proc *p)
+{
+  struct runq *rq = &cpus[p->lastcpu].runq;
+
+  p->state = RUNNABLE;
+
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Remove and return the process at the head of rq, or 0.
+static struct proc*
+runq_get(struct runq *rq)
+{
+  struct proc *p;
+
+  // Racy peek, so that scanning empty queues
+  // doesn't touch their locks.
+  if(rq->head == 0)
+    return 0;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Find a process for cpu c to run: its own queue first,
+// then steal from the busiest other queue.
+static struct proc*
+runq_pick(struct cpu *c)
+{
+  struct cpu *v, *victim;
+  struct proc *p;
+
+  if((p = runq_get(&c->runq)) != 0)
+    return p;
+
+  victim = 0;
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v != c && v->runq.n > 0 && (victim == 0 || v->runq.n > victim->runq.n))
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+  return runq_get(&victim->runq);
+}
+
 int
 allocpid()
 {
@@ -158,10 +239,13 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
+  if(p->pagetable){
+    vmaclose(p, 0);
     proc_freepagetable(p->pagetable, p->sz);
+  }
   p->pagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -249,7 +333,39 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->lastcpu = cpuid();
+  runq_put(p);
+
+  release(&p->lock);
+}
+
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Start a process that runs fn in the kernel and never
+// returns to user space. fn must not return.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  p->lastcpu = cpuid();
+  runq_put(p);
 
   release(&p->lock);
 }
@@ -264,9 +380,10 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // pages are allocated on first touch, by pagein().
+    if(sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -296,6 +413,13 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // Share mapped regions and their resident pages.
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -307,6 +431,12 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe){
+    np->exe = idup(p->exe);
+    itext(np->exe, 1);
+  }
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -319,7 +449,8 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->lastcpu = cpuid();
+  runq_put(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +482,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mapped regions.
+  vmaclose(p, 1);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -360,10 +494,15 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_opn(2*iputblocks());
   iput(p->cwd);
+  if(p->exe){
+    itext(p->exe, -1);
+    iput(p->exe);
+  }
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -437,7 +576,8 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from another CPU's queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -452,22 +592,24 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runq_pick(c)) == 0)
+      continue;
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->lastcpu = c - cpus;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -504,7 +646,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runq_put(p);
   sched();
   release(&p->lock);
 }
@@ -576,7 +718,7 @@ wakeup(void *chan)
       }
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        runq_put(p);
       }
       release(&p->lock);
     }
@@ -597,7 +739,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runq_put(p);
       }
       release(&p->lock);
       return 0;
@@ -18,12 +18,21 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU queue of RUNNABLE processes, linked through p->rqnext.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;          // Next process to run.
+  struct proc *tail;          // Most recently queued process.
+  int n;                      // Number of queued processes.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq runq;           // Processes waiting to run on this cpu.
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +88,25 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region mapped by mmap().
+struct vma {
+  uint64 addr;      // start, page-aligned; len == 0 if unused
+  uint64 len;
+  int prot;         // PROT_READ, PROT_WRITE
+  int flags;        // MAP_SHARED or MAP_PRIVATE, MAP_RAID
+  struct file *f;   // mapped file, or 0
+  uint64 off;       // offset of addr in the file or volume
+};
+
+// A loadable segment of the executable, paged in on demand.
+struct seg {
+  uint64 va;        // start, page-aligned
+  uint64 memsz;
+  uint64 off;       // offset in the executable
+  uint64 filesz;    // bytes read from it; the rest is zero
+  int perm;         // PTE_X, PTE_W
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,6 +119,10 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int lastcpu;                 // CPU this process last ran on
+
+  // the owning cpu's runq.lock must be held when using this:
+  struct proc *rqnext;         // Next process in the run queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -104,4 +136,11 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Body of a kernel thread, or 0
+  int logres;                  // Log blocks still reserved by begin_op()
+  struct sleeplock *shared[NSHARED]; // Sleep locks held shared
+  struct vma vma[NVMA];        // Mapped regions
+  struct inode *exe;           // Executable, for demand paging
+  int nseg;
+  struct seg seg[NSEG];        // Segments of exe not yet paged in eagerly
 };
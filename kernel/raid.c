@@ -613,7 +613,7 @@ int write_raid4(int blkn, uchar* data) {
     return 0;
 
   uchar buffer[BSIZE];
-  uchar* parity = (uchar*)kalloc();
+  uchar* parity = (uchar*)kmalloc(BSIZE);
   
   read_block(diskn, blockn, buffer); // read old data
   read_block(VIRTIO_RAID_DISK_END, blockn, parity); // read old parity
@@ -625,7 +625,7 @@ int write_raid4(int blkn, uchar* data) {
   write_block(VIRTIO_RAID_DISK_END, blockn, parity); // write new parity
 
   // free alocated memory
-  kfree(parity);
+  kmfree(parity);
 
   return 0;
 }
@@ -660,7 +660,7 @@ int disk_repaired_raid4(int diskn) {
     return -2;
 
   uchar buffer[BSIZE];
-  uchar* parity = (uchar*)kalloc();
+  uchar* parity = (uchar*)kmalloc(BSIZE);
   memset(parity, 0, BSIZE);
 
   for (int blockn = 1; blockn < NUMBER_OF_BLOCKS; blockn++) {
@@ -688,6 +688,9 @@ int disk_repaired_raid4(int diskn) {
 
   write_block(diskn, 0, buffer);
 
+  // free allocated memory
+  kmfree(parity);
+
   return 0;
 }
 
@@ -794,7 +797,7 @@ int write_raid5(int blkn, uchar* data) {
 
   // calculate parity using read-modify-write method
   uchar buffer[BSIZE];
-  uchar* parity = (uchar*)kalloc();
+  uchar* parity = (uchar*)kmalloc(BSIZE);
   
   if (!parity) return -2;
   memset(parity, 0, BSIZE);
@@ -809,7 +812,7 @@ int write_raid5(int blkn, uchar* data) {
   write_block(parity_location, blockn, parity); // write parity
 
   // free allocated memory
-  kfree(parity);
+  kmfree(parity);
 
   return 0;
 }
@@ -846,7 +849,7 @@ int disk_repaired_raid5(int diskn) {
     return 0;
 
   uchar buffer[BSIZE];
-  uchar* parity = (uchar*)kalloc();
+  uchar* parity = (uchar*)kmalloc(BSIZE);
 
   if (!parity) return -2;
 
@@ -867,7 +870,7 @@ int disk_repaired_raid5(int diskn) {
   write_block(diskn, 0, buffer);
 
   // free allocated memory
-  kfree(parity);
+  kmfree(parity);
 
   return 0;
 }
@@ -975,7 +978,10 @@ int read_raid(int blkn, uchar* data) {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
   
   int ret = -1;
   switch (raid_type) {
@@ -999,7 +1005,10 @@ int write_raid(int blkn, uchar* data) {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
 
   int ret = -1;
   switch (raid_type) {
@@ -1023,7 +1032,10 @@ int disk_fail_raid(int diskn) {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
 
   int ret = -1;
   switch (raid_type) {
@@ -1047,7 +1059,10 @@ int disk_repaired_raid(int diskn) {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
 
   int ret = -1;
   switch (raid_type) {
@@ -1071,7 +1086,10 @@ int info_raid(uint *blkn, uint *blks, uint *diskn) {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
 
   int ret = -1;
   switch (raid_type) {
@@ -1095,7 +1113,10 @@ int destroy_raid() {
 
   // check for raid
   enum RAID_TYPE raid_type = check_raid();
-  if (raid_type == RAID_NONE) return -1;
+  if (raid_type == RAID_NONE) {
+    unlock();
+    return -1;
+  }
 
   int ret = -1;
 
@@ -0,0 +1,133 @@
+//
+// The RAID volume as a device, /dev/raid0, so that any
+// program can read and write it like a file, at any offset
+// (see lseek()) and with any length.
+//
+// Whole blocks move straight between the disks and the
+// caller's memory when a block fits in one user page;
+// partial blocks at either end of a transfer go through a
+// bounce block, and are read first when written.
+//
+
+#include "raid.h"
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+#include "proc.h"
+
+// Kernel address for user_dst/user_src address a of
+// a whole block, if the RAID layer can use it directly.
+static uchar*
+raidaddr(int user, uint64 a, int write)
+{
+  if(!user)
+    return (uchar*)a;
+  return (uchar*)useraddr(myproc()->pagetable, a, BSIZE, write);
+}
+
+// Bytes in the volume, or -1 if there is no RAID.
+static long
+raidsize(void)
+{
+  uint blkn, blks, diskn;
+
+  if(info_raid(&blkn, &blks, &diskn) < 0)
+    return -1;
+  return (long)blkn * BSIZE;
+}
+
+// Read n bytes at byte offset off of the volume.
+// Returns the number of bytes read, 0 at the end,
+// or -1 if there is no RAID or nothing could be read.
+static int
+raiddevread(int user_dst, uint64 dst, uint off, int n)
+{
+  uchar *blk = 0, *pa;
+  uint o;
+  int i, m;
+  long size;
+
+  if((size = raidsize()) < 0)
+    return -1;
+  if(off >= size)
+    return 0;
+  if(n > size - off)
+    n = size - off;
+
+  for(i = 0; i < n; i += m){
+    o = (off + i) % BSIZE;
+    m = BSIZE - o;
+    if(m > n - i)
+      m = n - i;
+    if(m == BSIZE && (pa = raidaddr(user_dst, dst + i, 1)) != 0){
+      if(read_raid((off + i) / BSIZE, pa) < 0)
+        break;
+      continue;
+    }
+    if(blk == 0 && (blk = kmalloc(BSIZE)) == 0)
+      break;
+    if(read_raid((off + i) / BSIZE, blk) < 0)
+      break;
+    if(either_copyout(user_dst, dst + i, blk + o, m) == -1)
+      break;
+  }
+  if(blk)
+    kmfree(blk);
+  if(i == 0 && n > 0)
+    return -1;
+  return i;
+}
+
+// Write n bytes at byte offset off of the volume.
+// Returns the number of bytes written, short at the end,
+// or -1 if there is no RAID or nothing could be written.
+static int
+raiddevwrite(int user_src, uint64 src, uint off, int n)
+{
+  uchar *blk = 0, *pa;
+  uint o;
+  int i, m;
+  long size;
+
+  if((size = raidsize()) < 0 || off >= size)
+    return -1;
+  if(n > size - off)
+    n = size - off;
+
+  for(i = 0; i < n; i += m){
+    o = (off + i) % BSIZE;
+    m = BSIZE - o;
+    if(m > n - i)
+      m = n - i;
+    if(m == BSIZE && (pa = raidaddr(user_src, src + i, 0)) != 0){
+      if(write_raid((off + i) / BSIZE, pa) < 0)
+        break;
+      continue;
+    }
+    if(blk == 0 && (blk = kmalloc(BSIZE)) == 0)
+      break;
+    if(m < BSIZE && read_raid((off + i) / BSIZE, blk) < 0)
+      break;
+    if(either_copyin(blk + o, user_src, src + i, m) == -1)
+      break;
+    if(write_raid((off + i) / BSIZE, blk) < 0)
+      break;
+  }
+  if(blk)
+    kmfree(blk);
+  if(i == 0 && n > 0)
+    return -1;
+  return i;
+}
+
+void
+raiddevinit(void)
+{
+  devsw[RAIDDEV].pread = raiddevread;
+  devsw[RAIDDEV].pwrite = raiddevwrite;
+}
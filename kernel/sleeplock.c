@@ -15,6 +15,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
 }
 
@@ -22,14 +24,62 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->writers++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers. New readers
+// wait while a writer is waiting, so writers don't starve.
+// The hold is recorded in the process, so that only a
+// holder can release it and holdingsleepshared() works.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i;
+
+  for(i = 0; i < NSHARED; i++)
+    if(p->shared[i] == 0)
+      break;
+  if(i == NSHARED)
+    panic("acquiresleepshared");
+
+  acquire(&lk->lk);
+  while (lk->locked || lk->writers) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  p->shared[i] = lk;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i;
+
+  for(i = 0; i < NSHARED; i++)
+    if(p->shared[i] == lk)
+      break;
+  if(i == NSHARED)
+    panic("releasesleepshared");
+  p->shared[i] = 0;
+
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
@@ -51,5 +101,15 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Does the current process hold lk shared?
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+  int i;
 
-
+  for(i = 0; i < NSHARED; i++)
+    if(p->shared[i] == lk)
+      return 1;
+  return 0;
+}
@@ -1,6 +1,11 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either exclusively, or shared by any
+// number of readers (acquiresleepshared()).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Processes holding it shared,
+                     // each recorded in its p->shared[]
+  int writers;       // Processes waiting for it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
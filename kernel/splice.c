@@ -0,0 +1,177 @@
+//
+// splice(): move bytes from one of a file, a pipe, a device
+// or the RAID volume to another inside the kernel, so the
+// data never passes through user memory and each page of it
+// costs one system call instead of a read() and a write().
+//
+// The RAID volume is given as a null struct file and a byte
+// offset. Data moves a page at a time through a kernel page
+// that read_raid() and write_raid() DMA into and out of
+// directly; whole file blocks bound for the RAID volume go
+// straight from the buffer cache to the disks.
+//
+
+#include "raid.h"
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+
+// Read n bytes at byte offset *off of the RAID volume
+// into dst, and advance *off. Returns the number of
+// bytes read, short if the volume ends or fails.
+static int
+raidread(uint64 *off, char *dst, int n)
+{
+  uchar *blk = 0;
+  uint o;
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    o = (*off + i) % BSIZE;
+    m = BSIZE - o;
+    if(m > n - i)
+      m = n - i;
+    if(m == BSIZE){
+      if(read_raid((*off + i) / BSIZE, (uchar*)dst + i) < 0)
+        break;
+    } else {
+      if(blk == 0 && (blk = kmalloc(BSIZE)) == 0)
+        break;
+      if(read_raid((*off + i) / BSIZE, blk) < 0)
+        break;
+      memmove(dst + i, blk + o, m);
+    }
+  }
+  if(blk)
+    kmfree(blk);
+  *off += i;
+  return i;
+}
+
+// Write n bytes from src at byte offset *off of the RAID
+// volume, and advance *off. Partial blocks are read first.
+// Returns the number of bytes written.
+static int
+raidwrite(uint64 *off, char *src, int n)
+{
+  uchar *blk = 0;
+  uint o;
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    o = (*off + i) % BSIZE;
+    m = BSIZE - o;
+    if(m > n - i)
+      m = n - i;
+    if(m == BSIZE){
+      if(write_raid((*off + i) / BSIZE, (uchar*)src + i) < 0)
+        break;
+    } else {
+      if(blk == 0 && (blk = kmalloc(BSIZE)) == 0)
+        break;
+      if(read_raid((*off + i) / BSIZE, blk) < 0)
+        break;
+      memmove(blk + o, src + i, m);
+      if(write_raid((*off + i) / BSIZE, blk) < 0)
+        break;
+    }
+  }
+  if(blk)
+    kmfree(blk);
+  *off += i;
+  return i;
+}
+
+// Write whole blocks of file f, from f->off on, to the
+// RAID volume at *off straight from the buffer cache,
+// up to n bytes. Returns the number of bytes moved, which
+// is 0 if f->off isn't block-aligned or less than a block
+// of the file is left.
+static int
+filetoraid(struct file *f, uint64 *off, int n)
+{
+  struct inode *ip = f->ip;
+  struct buf *b;
+  int i;
+
+  if(f->off % BSIZE)
+    return 0;
+  ilock(ip);
+  if(f->off >= ip->size){
+    iunlock(ip);
+    return 0;
+  }
+  if(n > ip->size - f->off)
+    n = ip->size - f->off;
+  n -= n % BSIZE;
+  for(i = 0; i < n; i += BSIZE){
+    if((b = ibread(ip, (f->off + i) / BSIZE)) == 0)
+      break;
+    if(write_raid((*off + i) / BSIZE, b->data) < 0){
+      brelse(b);
+      break;
+    }
+    brelse(b);
+  }
+  f->off += i;
+  iunlock(ip);
+  *off += i;
+  return i;
+}
+
+// Move up to n bytes from in to out; a null file is the
+// RAID volume at byte offset inoff or outoff. Stops early
+// at the end of in, or after a short write to out. Returns
+// the number of bytes moved, or -1 if nothing could be moved
+// because of an error.
+int
+splice(struct file *in, uint64 inoff, struct file *out, uint64 outoff, uint64 n)
+{
+  char *buf;
+  uint64 done;
+  int m, r = 0, w;
+
+  if(in == 0 && out == 0)
+    return -1;
+  if((in && !in->readable) || (out && !out->writable))
+    return -1;
+  if(n > 0x7fffffff)
+    n = 0x7fffffff;  // the count must fit the int return value
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  for(done = 0; done < n; done += r){
+    m = n - done < PGSIZE ? n - done : PGSIZE;
+    if(in && in->type == FD_INODE && out == 0 && outoff % BSIZE == 0 &&
+       (r = filetoraid(in, &outoff, m)) > 0)
+      continue;
+
+    if(in == 0)
+      r = raidread(&inoff, buf, m);
+    else
+      r = fileread(in, 0, (uint64)buf, m);
+    if(r <= 0)
+      break;
+    if(out == 0)
+      w = raidwrite(&outoff, buf, r);
+    else
+      w = filewrite(out, 0, (uint64)buf, r);
+    if(w != r){
+      if(w > 0)
+        done += w;
+      r = -1;
+      break;
+    }
+  }
+  kfree(buf);
+
+  if(r < 0 && done == 0)
+    return -1;
+  return done;
+}
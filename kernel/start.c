@@ -46,6 +46,11 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+#ifdef MEMBENCH
+  // let supervisor mode read the time CSR for membench().
+  w_mcounteren(r_mcounteren() | 2);
+#endif
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
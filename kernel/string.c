@@ -1,13 +1,41 @@
 #include "types.h"
 
+// memset, memcmp and memmove work a 64-bit word at a time
+// when the addresses allow it, and a byte at a time at the
+// unaligned ends. The kernel is built with -O0, so the
+// word loops are unrolled by hand.
+
+#define WSIZE sizeof(uint64)
+#define WMASK (WSIZE - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *cdst = (uchar *) dst;
+  uint64 *w, x;
+
+  if(n >= 4*WSIZE){
+    while((uint64)cdst & WMASK){
+      *cdst++ = c;
+      n--;
+    }
+    x = (uchar)c;
+    x |= x << 8;
+    x |= x << 16;
+    x |= x << 32;
+    w = (uint64 *) cdst;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, w += 4){
+      w[0] = x;
+      w[1] = x;
+      w[2] = x;
+      w[3] = x;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *w++ = x;
+    cdst = (uchar *) w;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +46,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(n >= WSIZE && (((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while((uint64)s1 & WMASK){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes find the difference.
+    while(n >= WSIZE && *(uint64 *)s1 == *(uint64 *)s2)
+      s1 += WSIZE, s2 += WSIZE, n -= WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +70,63 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int words;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  // words only if s and d can both be aligned.
+  words = n >= 4*WSIZE && (((uint64)s ^ (uint64)d) & WMASK) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while((uint64)d & WMASK){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        ws -= 4, wd -= 4;
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while((uint64)d & WMASK){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, ws += 4, wd += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -134,3 +215,76 @@ strlen(const char *s)
   return n;
 }
 
+
+#ifdef MEMBENCH
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+// Byte-loop versions, to compare against.
+static void
+bytemove(char *d, const char *s, uint n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static void
+byteset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static int
+bytecmp(const uchar *s1, const uchar *s2, uint n)
+{
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
+// Print the time per call of memmove, memset and memcmp,
+// and of byte loops doing the same, for each size class.
+// Built with MEMBENCH=1; run once at boot.
+void
+membench(void)
+{
+  static uint sizes[] = { 16, 64, 256, 1024, 4096 };
+  char *a, *b;
+  uint64 t[7];
+  int i, j, iters;
+
+  if((a = kalloc()) == 0 || (b = kalloc()) == 0)
+    panic("membench");
+  memset(b, 0, PGSIZE);
+  printf("membench: ticks of time per call, byte loop / word\n");
+  printf("size\tmemmove\t\tmemset\t\tmemcmp\n");
+  for(i = 0; i < NELEM(sizes); i++){
+    iters = (1 << 20) / sizes[i];
+    t[0] = r_time();
+    for(j = 0; j < iters; j++) bytemove(a, b, sizes[i]);
+    t[1] = r_time();
+    for(j = 0; j < iters; j++) memmove(a, b, sizes[i]);
+    t[2] = r_time();
+    for(j = 0; j < iters; j++) byteset(a, j, sizes[i]);
+    t[3] = r_time();
+    for(j = 0; j < iters; j++) memset(a, j, sizes[i]);
+    t[4] = r_time();
+    memset(a, 0, PGSIZE);  // untimed: memcmp needs a == b
+    t[5] = r_time();
+    for(j = 0; j < iters; j++) bytecmp((uchar*)a, (uchar*)b, sizes[i]);
+    t[6] = r_time();
+    for(j = 0; j < iters; j++) memcmp(a, b, sizes[i]);
+    printf("%d\t%d / %d\t%d / %d\t%d / %d\n", sizes[i],
+           (int)((t[1]-t[0])/iters), (int)((t[2]-t[1])/iters),
+           (int)((t[3]-t[2])/iters), (int)((t[4]-t[3])/iters),
+           (int)((t[6]-t[5])/iters), (int)((r_time()-t[6])/iters));
+  }
+  kfree(a);
+  kfree(b);
+}
+#endif
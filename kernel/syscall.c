@@ -109,6 +109,13 @@ extern uint64 sys_disk_fail_raid(void);
 extern uint64 sys_disk_repaired_raid(void);
 extern uint64 sys_info_raid(void);
 extern uint64 sys_destroy_raid(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -141,7 +148,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_disk_fail_raid] sys_disk_fail_raid,
 [SYS_disk_repaired_raid] sys_disk_repaired_raid,
 [SYS_info_raid] sys_info_raid,
-[SYS_destroy_raid] sys_destroy_raid
+[SYS_destroy_raid] sys_destroy_raid,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync] sys_msync,
+[SYS_splice] sys_splice,
+[SYS_lseek] sys_lseek,
+[SYS_pread] sys_pread,
+[SYS_pwrite] sys_pwrite
 };
 
 void
@@ -27,4 +27,11 @@
 #define SYS_disk_fail_raid 25
 #define SYS_disk_repaired_raid 26
 #define SYS_info_raid 27
-#define SYS_destroy_raid 28
\ No newline at end of file
+#define SYS_destroy_raid 28
+#define SYS_mmap 29
+#define SYS_munmap 30
+#define SYS_msync 31
+#define SYS_splice 32
+#define SYS_lseek 33
+#define SYS_pread 34
+#define SYS_pwrite 35
\ No newline at end of file
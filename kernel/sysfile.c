@@ -76,7 +76,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  return fileread(f, 1, p, n);
 }
 
 uint64
@@ -91,7 +91,7 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  return filewrite(f, 1, p, n);
 }
 
 uint64
@@ -189,14 +189,15 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  // the directory entry's block, dp's inode, and, if this
+  // was the last link, whatever freeing ip writes.
+  begin_opn(2 + iputblocks());
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -219,8 +220,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(dirunlink(dp, name, off) < 0)
     panic("unlink: writei");
   if(ip->type == T_DIR){
     dp->nlink--;
@@ -341,6 +341,13 @@ sys_open(void)
     return -1;
   }
 
+  // can't truncate a program that is running.
+  if((omode & O_TRUNC) && ip->type == T_FILE && ip->text > 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -355,6 +362,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->rawin = 0;
+    f->raend = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -413,7 +423,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_opn(iputblocks());  // the old cwd may be an unlinked directory
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -503,3 +513,125 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  // argument 0, the address hint, is ignored.
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if((flags & MAP_RAID) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_msync(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return msync(addr, len);
+}
+
+uint64
+sys_splice(void)
+{
+  int fdin, fdout;
+  uint64 offin, offout, n;
+  struct file *in = 0, *out = 0;
+
+  // an fd of SPLICE_RAID is the RAID volume, at byte
+  // offset offin or offout; other offsets are ignored.
+  argint(0, &fdin);
+  argaddr(1, &offin);
+  argint(2, &fdout);
+  argaddr(3, &offout);
+  argaddr(4, &n);
+  if(fdin != SPLICE_RAID && argfd(0, 0, &in) < 0)
+    return -1;
+  if(fdout != SPLICE_RAID && argfd(2, 0, &out) < 0)
+    return -1;
+  return splice(in, offin, out, offout, n);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+  long n;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  argint(1, &off);
+  argint(2, &whence);
+  if(f->type != FD_INODE && (f->type != FD_DEVICE || f->major < 0 ||
+     f->major >= NDEV || !devsw[f->major].pread))
+    return -1;
+
+  if(whence == SEEK_SET){
+    n = off;
+  } else if(whence == SEEK_CUR){
+    n = (long)f->off + off;
+  } else if(whence == SEEK_END && f->type == FD_INODE){
+    ilock(f->ip);
+    n = (long)f->ip->size + off;
+    iunlock(f->ip);
+  } else {
+    return -1;
+  }
+  if(n < 0 || n > 0xFFFFFFFFL)
+    return -1;
+  f->off = n;
+  return n;
+}
+
+// pread(fd, buf, n, off) and pwrite(fd, buf, n, off) read
+// and write at byte offset off, leaving fd's offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
@@ -106,14 +106,20 @@ sys_read_raid(void) {
   argint(0, &blkn);
   argaddr(1, &data);
 
-  uchar buffer[BSIZE];
-  if (read_raid(blkn, (uchar*)buffer) < 0)
-    return -1;
+  // read straight into the user's page if the block fits in it.
+  uint64 pa = useraddr(myproc()->pagetable, data, BSIZE, 1);
+  if (pa)
+    return read_raid(blkn, (uchar*)pa);
 
-  if (copyout(myproc()->pagetable, data, (char*)buffer, BSIZE) < 0)
+  uchar *buffer = kmalloc(BSIZE);
+  if (buffer == 0)
     return -1;
+  int ret = read_raid(blkn, buffer);
+  if (ret == 0 && copyout(myproc()->pagetable, data, (char*)buffer, BSIZE) < 0)
+    ret = -1;
+  kmfree(buffer);
 
-  return 0;
+  return ret;
 }
 
 uint64
@@ -123,11 +129,20 @@ sys_write_raid(void) {
   argint(0, &blkn);
   argaddr(1, &data);
 
-  uchar buffer[BSIZE];
-  if (copyin(myproc()->pagetable, (char*)buffer, data, BSIZE) < 0)
+  // write straight from the user's page if the block fits in it.
+  uint64 pa = useraddr(myproc()->pagetable, data, BSIZE, 0);
+  if (pa)
+    return write_raid(blkn, (uchar*)pa);
+
+  uchar *buffer = kmalloc(BSIZE);
+  if (buffer == 0)
     return -1;
+  int ret = -1;
+  if (copyin(myproc()->pagetable, (char*)buffer, data, BSIZE) == 0)
+    ret = write_raid(blkn, buffer);
+  kmfree(buffer);
 
-  return write_raid(blkn, buffer);
+  return ret;
 }
 
 uint64
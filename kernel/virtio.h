@@ -47,7 +47,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 16
+#define NUM 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -51,6 +51,7 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;    // started by virtio_disk_start()?
   } info[NUM];
 
   // disk command headers.
@@ -156,11 +157,16 @@ virtio_disk_init(int id, char * name)
   *R(id, VIRTIO_MMIO_STATUS) = status;
 
   if (id >= VIRTIO_RAID_DISK_START) {
-    transfer_buffer[id] = kalloc();
+    transfer_buffer[id] = kmalloc(sizeof(struct buf));
     if (!transfer_buffer[id]) {
-      panic("virtio_disk_init: kalloc of transfer_buffer failed");
+      panic("virtio_disk_init: kmalloc of transfer_buffer failed");
     }
-    memset(transfer_buffer[id], 0, BSIZE);
+    memset(transfer_buffer[id], 0, sizeof(struct buf));
+    transfer_buffer[id]->data = kmalloc(BSIZE);
+    if (!transfer_buffer[id]->data) {
+      panic("virtio_disk_init: kmalloc of transfer_buffer data failed");
+    }
+    memset(transfer_buffer[id]->data, 0, BSIZE);
     initsleeplock(&transfer_buffer[id]->lock, "transfer_buffer");
   }
 
@@ -228,13 +234,14 @@ alloc3_desc(int id, int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(int id, struct buf *b, int write)
+// queue a request to read or write b, and notify the device.
+// caller must hold disk[id].vdisk_lock.
+// virtio_disk_intr() frees the descriptors.
+static void
+virtio_disk_submit(int id, struct buf *b, int write, int async)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk[id].vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
@@ -284,6 +291,7 @@ virtio_disk_rw(int id, struct buf *b, int write)
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
   disk[id].info[idx[0]].b = b;
+  disk[id].info[idx[0]].async = async;
 
   // tell the device the first index in our chain of descriptors.
   disk[id].avail->ring[disk[id].avail->idx % NUM] = idx[0];
@@ -296,17 +304,72 @@ virtio_disk_rw(int id, struct buf *b, int write)
   __sync_synchronize();
 
   *R(id, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+void
+virtio_disk_rw(int id, struct buf *b, int write)
+{
+  acquire(&disk[id].vdisk_lock);
+
+  virtio_disk_submit(id, b, write, 0);
 
   // Wait for virtio_disk_intr() to say request has finished.
-  sleep(b, &disk[id].vdisk_lock);
+  while(b->disk == 1)
+    sleep(b, &disk[id].vdisk_lock);
+
+  release(&disk[id].vdisk_lock);
+}
+
+// read or write the n bufs in bs[], queueing as many as the
+// descriptor ring holds before waiting, so the device sees
+// them as one batch.
+void
+virtio_disk_rwv(int id, struct buf **bs, int n, int write)
+{
+  int i;
 
-  disk[id].info[idx[0]].b = 0;
-  free_chain(id, idx[0]);
+  acquire(&disk[id].vdisk_lock);
+
+  for(i = 0; i < n; i++)
+    virtio_disk_submit(id, bs[i], write, 0);
+
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1)
+      sleep(bs[i], &disk[id].vdisk_lock);
+  }
+
+  release(&disk[id].vdisk_lock);
+}
 
+// start reading or writing b and return without waiting.
+// b must be locked; virtio_disk_intr() hands it to bdone()
+// when the device has finished.
+void
+virtio_disk_start(int id, struct buf *b, int write)
+{
+  acquire(&disk[id].vdisk_lock);
+  virtio_disk_submit(id, b, write, 1);
   release(&disk[id].vdisk_lock);
 }
 
+// can the device reach data directly? kernel stacks are
+// mapped apart from the direct map of RAM, so data on them
+// has to go through the transfer buffer.
+static int
+dmaable(uchar *data)
+{
+  return (uint64)data >= KERNBASE && (uint64)data + BSIZE <= PHYSTOP;
+}
+
 void write_block(int diskn, int blockno, uchar* data) {
+    struct buf db;
+    if (dmaable(data)) {
+        db.blockno = blockno;
+        db.data = data;
+        virtio_disk_rw(diskn, &db, 1);
+        return;
+    }
+
     struct buf *b = transfer_buffer[diskn];
     b->blockno = blockno;
     memmove(b->data, data, BSIZE);
@@ -315,6 +378,14 @@ void write_block(int diskn, int blockno, uchar* data) {
 }
 
 void read_block(int diskn, int blockno, uchar* data) {
+    struct buf db;
+    if (dmaable(data)) {
+        db.blockno = blockno;
+        db.data = data;
+        virtio_disk_rw(diskn, &db, 0);
+        return;
+    }
+
     struct buf *b = transfer_buffer[diskn];
     b->blockno = blockno;
 
@@ -348,9 +419,15 @@ virtio_disk_intr(int id)
       panic_concat(2, disk[id].name, ": virtio_disk_intr status");
 
     struct buf *b = disk[id].info[idx].b;
+    int async = disk[id].info[idx].async;
     b->disk = 0;   // disk is done with buf
+    disk[id].info[idx].b = 0;
+    free_chain(id, idx);
 
-    wakeup(b);
+    if(async)
+      bdone(b);
+    else
+      wakeup(b);
 
     disk[id].used_idx += 1;
   }
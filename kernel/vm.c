@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,8 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -86,15 +90,28 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A valid PTE with any of R, W or X set at level 1 is a
+// leaf that maps a whole 2MB megapage; walk() returns it.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but return the PTE at level leaf, which
+// maps a page of size PGSIZE << (9*leaf).
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf)
 {
   if(va >= MAXVA)
     return 0;
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > leaf; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;  // a megapage
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -103,7 +120,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(leaf, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -141,13 +158,19 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Kernel mappings (without PTE_U) use 2MB
+// megapages wherever va and pa are both megapage-aligned and
+// a whole megapage is left to map, so that the kernel's
+// direct map takes fewer TLB entries; user pages are always
+// 4KB, since they are allocated, shared and copied one by one.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int mega;
 
   if(size == 0)
     panic("mappages: size");
@@ -155,11 +178,20 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    mega = (perm & PTE_U) == 0 && a % MPGSIZE == 0 && pa % MPGSIZE == 0 &&
+           last - a >= MPGSIZE - PGSIZE;
+    if((pte = walklevel(pagetable, a, 1, mega)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    if(mega){
+      if(last - a == MPGSIZE - PGSIZE)
+        break;
+      a += MPGSIZE;
+      pa += MPGSIZE;
+      continue;
+    }
     if(a == last)
       break;
     a += PGSIZE;
@@ -181,10 +213,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    // pages that were never touched were never allocated.
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -302,8 +333,10 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the child shares the
+// parent's physical pages, and writable pages become
+// read-only and copy-on-write in both; uvmcow() copies
+// such a page when either process stores to it.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -312,30 +345,57 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // not paged in yet
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kdup((void*)pa);
   }
+  sfence_vma();
   return 0;
 
  err:
+  sfence_vma();
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
 
+// Handle a store to copy-on-write page va: give the page
+// its own copy, or just make it writable if no other page
+// table shares it any more.
+// returns 0 on success, -1 if va isn't copy-on-write
+// or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  if(krefs((void*)pa) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+    kfree((void*)pa);
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  sfence_vma();
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -349,6 +409,124 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Return the PTE for user page va0 during a copy that
+// moves up one page at a time. pte is the previous page's
+// PTE, or 0 for the first page. While va0 is in the same
+// page-table page as the previous page, the next PTE is
+// pte+1, so only every 512th page needs a walk().
+static pte_t*
+walknext(pagetable_t pagetable, uint64 va0, pte_t *pte)
+{
+  if(pte && PX(0, va0) != 0)
+    return pte + 1;
+  if(va0 >= MAXVA)
+    return 0;
+  return walk(pagetable, va0, 0);
+}
+
+// The physical address of the user page pte maps, or 0.
+static uint64
+pteaddr(pte_t *pte)
+{
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  return PTE2PA(*pte);
+}
+
+// Is pte a user page the process may write, now or after
+// copying it?
+static int
+uvmwritable(pte_t *pte)
+{
+  return pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) &&
+         (*pte & (PTE_W|PTE_COW)) != 0;
+}
+
+// Make writable user page va copy-on-write, to hand it to
+// a pipe without copying. Returns its physical address, with
+// a new reference for the caller, or 0 if va isn't writable.
+uint64
+uvmshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = walk(pagetable, va, 0);
+
+  if(!uvmwritable(pte))
+    return 0;
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    sfence_vma();
+  }
+  kdup((void*)PTE2PA(*pte));
+  return PTE2PA(*pte);
+}
+
+// Map page pa copy-on-write at writable user page va, in
+// place of the page there, to take a page from a pipe
+// without copying. Returns 0, or -1 if va isn't writable.
+int
+uvmreplace(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte = walk(pagetable, va, 0);
+  uint64 old;
+
+  if(!uvmwritable(pte))
+    return -1;
+  old = PTE2PA(*pte);
+  kdup((void*)pa);
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW;
+  sfence_vma();
+  kfree((void*)old);
+  return 0;
+}
+
+// Handle a page fault at va in p's user memory: copy a
+// copy-on-write page, page in the image or heap, or fill
+// an mmap()ed page.
+// Returns 0 if the access can be retried, -1 if it's bad.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  if(va >= MAXVA)
+    return -1;
+  if(write && uvmcow(p->pagetable, va) == 0)
+    return 0;
+  if(va < p->sz)
+    return pagein(p, va);
+  return vmfault(p, va, write);
+}
+
+// Fault in page va0 for copyin()/copyout(), if pagetable
+// is the current process's. Returns the page's PTE, or 0.
+static pte_t*
+copyfault(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable || uvmfault(p, va0, write) < 0)
+    return 0;
+  return walk(pagetable, va0, 0);
+}
+
+// Return the kernel (direct-mapped) address of user range
+// [va, va+len), or 0 unless it lies within one user page that
+// is mapped, and writable if write is set. The page stays put
+// while the calling process is in the kernel, so the caller
+// may hand the address to a device.
+uint64
+useraddr(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  pte_t *pte;
+
+  if(len == 0 || va >= MAXVA || va % PGSIZE + len > PGSIZE)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pteaddr(pte) == 0)
+    return 0;
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + va % PGSIZE;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -356,10 +534,14 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pte = walknext(pagetable, va0, pte);
+    if(pteaddr(pte) == 0 || (*pte & PTE_W) == 0)
+      pte = copyfault(pagetable, va0, 1);
+    pa0 = pteaddr(pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -381,10 +563,14 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pte = walknext(pagetable, va0, pte);
+    if(pteaddr(pte) == 0)
+      pte = copyfault(pagetable, va0, 0);
+    pa0 = pteaddr(pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -408,10 +594,14 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  pte_t *pte = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pte = walknext(pagetable, va0, pte);
+    if(pteaddr(pte) == 0)
+      pte = copyfault(pagetable, va0, 0);
+    pa0 = pteaddr(pte);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,216 @@
+// dd: copy data between files and devices such as /dev/raid0,
+// and report throughput and per-request latency.
+//
+//   dd if=FILE of=FILE [bs=BYTES] [count=N] [skip=N] [seek=N] [workers=N]
+//
+// Copies count blocks of bs bytes, starting skip blocks into
+// the input and seek blocks into the output. A regular output
+// file is truncated first unless seek is given, in which case
+// whatever lies past the copied blocks is kept. With workers=N,
+// N processes each copy their own share of the blocks at the
+// same time, so count is then required and the output must be
+// a device such as /dev/raid0: a worker can't seek past the
+// end of a regular file that the others have yet to fill in.
+// Times are measured in 10ms clock ticks, so the per-request
+// latency is only as fine as a tick and reads 0 for requests
+// that finish within one.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MSPERTICK 10
+#define MAXWORKERS 16
+
+struct stats {
+  uint64 bytes;
+  int reqs;
+  int ticks;     // summed over requests
+  int maxticks;
+  int err;
+};
+
+char *infile, *outfile;
+int bs = 4096, count = -1, skip, seek, workers = 1;
+
+// Value of argument s if it is key=value, else 0.
+char*
+arg(char *s, char *key)
+{
+  int n = strlen(key);
+
+  if(memcmp(s, key, n) == 0 && s[n] == '=')
+    return s + n + 1;
+  return 0;
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: dd if=FILE of=FILE [bs=BYTES] [count=N] [skip=N] [seek=N] [workers=N]\n");
+  exit(1);
+}
+
+// Copy n blocks (all of the input if n < 0), from block
+// in of the input to block out of the output.
+void
+copy(int n, int in, int out, struct stats *st, char *buf)
+{
+  int fdin, fdout, mode, r, t0, t;
+
+  if((fdin = open(infile, O_RDONLY)) < 0){
+    fprintf(2, "dd: cannot open %s\n", infile);
+    st->err = 1;
+    return;
+  }
+  mode = O_WRONLY|O_CREATE;
+  if(seek == 0 && workers == 1)
+    mode |= O_TRUNC;
+  if((fdout = open(outfile, mode)) < 0){
+    fprintf(2, "dd: cannot open %s\n", outfile);
+    close(fdin);
+    st->err = 1;
+    return;
+  }
+  if((in && lseek(fdin, in * bs, SEEK_SET) < 0) ||
+     (out && lseek(fdout, out * bs, SEEK_SET) < 0)){
+    fprintf(2, "dd: cannot seek\n");
+    st->err = 1;
+    goto done;
+  }
+
+  while(n < 0 || st->reqs < n){
+    t0 = uptime();
+    if((r = read(fdin, buf, bs)) <= 0){
+      if(r < 0){
+        fprintf(2, "dd: read error\n");
+        st->err = 1;
+      }
+      break;
+    }
+    if(write(fdout, buf, r) != r){
+      fprintf(2, "dd: write error\n");
+      st->err = 1;
+      break;
+    }
+    t = uptime() - t0;
+    st->ticks += t;
+    if(t > st->maxticks)
+      st->maxticks = t;
+    st->bytes += r;
+    st->reqs++;
+  }
+
+ done:
+  close(fdin);
+  close(fdout);
+}
+
+// Print v/100 with two decimals.
+void
+printfixed(uint64 v)
+{
+  printf("%d.%d%d", (int)(v / 100), (int)(v / 10 % 10), (int)(v % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stats st, w;
+  struct stat ost;
+  int i, n, first, pid, t0, ticks, p[2];
+  char *v, *buf;
+
+  for(i = 1; i < argc; i++){
+    if((v = arg(argv[i], "if")) != 0)
+      infile = v;
+    else if((v = arg(argv[i], "of")) != 0)
+      outfile = v;
+    else if((v = arg(argv[i], "bs")) != 0)
+      bs = atoi(v);
+    else if((v = arg(argv[i], "count")) != 0)
+      count = atoi(v);
+    else if((v = arg(argv[i], "skip")) != 0)
+      skip = atoi(v);
+    else if((v = arg(argv[i], "seek")) != 0)
+      seek = atoi(v);
+    else if((v = arg(argv[i], "workers")) != 0)
+      workers = atoi(v);
+    else
+      usage();
+  }
+  if(infile == 0 || outfile == 0 || bs <= 0 || workers < 1 || workers > MAXWORKERS)
+    usage();
+  if(workers > 1 && count < 0){
+    fprintf(2, "dd: workers=N needs count=N\n");
+    exit(1);
+  }
+  if(workers > 1 && (stat(outfile, &ost) < 0 || ost.type != T_DEVICE)){
+    fprintf(2, "dd: workers=N needs a device as output\n");
+    exit(1);
+  }
+  // page-aligned, so /dev/raid0 moves whole blocks
+  // straight into and out of it.
+  if((buf = raidalloc(bs)) == 0){
+    fprintf(2, "dd: out of memory\n");
+    exit(1);
+  }
+
+  memset(&st, 0, sizeof(st));
+  t0 = uptime();
+  if(workers == 1){
+    copy(count, skip, seek, &st, buf);
+  } else {
+    // each worker sends its stats back through the pipe.
+    if(pipe(p) < 0){
+      fprintf(2, "dd: pipe failed\n");
+      exit(1);
+    }
+    first = 0;
+    for(i = 0; i < workers; i++){
+      n = count / workers + (i < count % workers);
+      if((pid = fork()) < 0){
+        fprintf(2, "dd: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        close(p[0]);
+        memset(&w, 0, sizeof(w));
+        copy(n, skip + first, seek + first, &w, buf);
+        write(p[1], &w, sizeof(w));
+        exit(w.err);
+      }
+      first += n;
+    }
+    close(p[1]);
+    for(i = 0; i < workers; i++){
+      if(read(p[0], &w, sizeof(w)) != sizeof(w)){
+        st.err = 1;
+        break;
+      }
+      st.bytes += w.bytes;
+      st.reqs += w.reqs;
+      st.ticks += w.ticks;
+      if(w.maxticks > st.maxticks)
+        st.maxticks = w.maxticks;
+      st.err |= w.err;
+    }
+    close(p[0]);
+    for(i = 0; i < workers; i++)
+      wait(0);
+  }
+  ticks = uptime() - t0;
+  if(ticks == 0)
+    ticks = 1;
+
+  printf("%d requests, %d bytes in %d ms, ", st.reqs, (int)st.bytes, ticks * MSPERTICK);
+  printfixed(st.bytes * 100 * (1000 / MSPERTICK) / ticks / (1024 * 1024));
+  printf(" MB/s\n");
+  if(st.reqs > 0){
+    printf("latency (%dms ticks): avg ", MSPERTICK);
+    printfixed((uint64)st.ticks * 100 / st.reqs);
+    printf(" ticks, max %d ticks\n", st.maxticks);
+  }
+  exit(st.err);
+}
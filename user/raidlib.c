@@ -0,0 +1,112 @@
+// A thin library over the RAID volume for user programs.
+//
+// raidread() and raidwrite() move any byte range of the volume
+// with one pread() or pwrite() of /dev/raid0, so a range costs
+// one kernel crossing however many blocks it spans. They never
+// use the descriptor's offset, so a parent and a child that
+// share the descriptor after fork() can't move each other's
+// requests. Buffers from raidalloc() are page-aligned, which lets
+// the kernel move whole blocks straight into and out of them.
+// raidstats() reports what this process has done so far.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+static int raidfd = -1;
+static struct raidstats stats;
+
+// Open /dev/raid0 on first use.
+static int
+raidopen(void)
+{
+  if(raidfd < 0)
+    raidfd = open("/dev/raid0", O_RDWR);
+  return raidfd;
+}
+
+// Allocate n bytes aligned to a page. The pointer
+// malloc() returned is kept just below the buffer.
+void*
+raidalloc(uint n)
+{
+  char *p, *a;
+
+  if((p = malloc(n + PGSIZE + sizeof(char*))) == 0)
+    return 0;
+  a = (char*)(((uint64)p + sizeof(char*) + PGSIZE - 1) & ~(uint64)(PGSIZE - 1));
+  ((char**)a)[-1] = p;
+  return a;
+}
+
+void
+raidfree(void *a)
+{
+  if(a)
+    free(((char**)a)[-1]);
+}
+
+// Size of the volume: blocks, bytes per block, and disks.
+int
+raidinfo(uint *nblocks, uint *bsize, uint *ndisks)
+{
+  stats.calls++;
+  return info_raid(nblocks, bsize, ndisks);
+}
+
+// Read n bytes at byte offset off of the volume into buf.
+// Returns the number of bytes read, or -1.
+int
+raidread(uint off, void *buf, uint n)
+{
+  int r;
+
+  if(raidopen() < 0)
+    return -1;
+  stats.calls++;
+  if((r = pread(raidfd, buf, n, off)) > 0){
+    stats.reads++;
+    stats.rbytes += r;
+  }
+  return r;
+}
+
+// Write n bytes from buf at byte offset off of the volume.
+// Returns the number of bytes written, or -1.
+int
+raidwrite(uint off, const void *buf, uint n)
+{
+  int r;
+
+  if(raidopen() < 0)
+    return -1;
+  stats.calls++;
+  if((r = pwrite(raidfd, buf, n, off)) > 0){
+    stats.writes++;
+    stats.wbytes += r;
+  }
+  return r;
+}
+
+// Read n whole blocks from block blkn on, of size bsize.
+int
+raidreadblocks(uint blkn, uint n, uint bsize, void *buf)
+{
+  return raidread(blkn * bsize, buf, n * bsize) == n * bsize ? 0 : -1;
+}
+
+// Write n whole blocks from block blkn on, of size bsize.
+int
+raidwriteblocks(uint blkn, uint n, uint bsize, const void *buf)
+{
+  return raidwrite(blkn * bsize, buf, n * bsize) == n * bsize ? 0 : -1;
+}
+
+// Copy this process's counts of RAID calls and traffic to st.
+void
+raidstats(struct raidstats *st)
+{
+  *st = stats;
+}
@@ -48,4 +48,28 @@ int disk_fail_raid(int diskn);
 int disk_repaired_raid(int diskn);
 int info_raid(uint *blkn, uint *blks, uint *diskn);
 int destroy_raid();
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int msync(void*, uint);
+int splice(int, uint, int, uint, uint);
+int lseek(int, int, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+
+// raidlib.c
+struct raidstats {
+  uint calls;      // system calls made
+  uint reads;      // raidread() requests that moved data
+  uint writes;     // raidwrite() requests that moved data
+  uint64 rbytes;   // bytes read
+  uint64 wbytes;   // bytes written
+};
+void* raidalloc(uint);
+void raidfree(void*);
+int raidinfo(uint*, uint*, uint*);
+int raidread(uint, void*, uint);
+int raidwrite(uint, const void*, uint);
+int raidreadblocks(uint, uint, uint, void*);
+int raidwriteblocks(uint, uint, uint, const void*);
+void raidstats(struct raidstats*);
 
@@ -1145,6 +1145,522 @@ sharedfd(char *s)
   }
 }
 
+// read() a file into an mmap() of that same file, whose
+// pages fault in while read() holds the inode lock shared,
+// as another process keeps waiting to write the file.
+void
+mmapread(char *s)
+{
+  enum { SZ = 8*PGSIZE, N = 20 };
+  static char buf[SZ];
+  int fd, pid, i, j, xstatus;
+  char *p;
+
+  unlink("mmapread");
+  fd = open("mmapread", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: cannot create mmapread\n", s);
+    exit(1);
+  }
+  memset(buf, 'a', SZ);
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write mmapread failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memset(buf, 'b', SZ);
+    for(i = 0; i < 4*N; i++){
+      fd = open("mmapread", O_WRONLY);
+      if(fd < 0 || write(fd, buf, SZ) != SZ){
+        printf("%s: rewrite mmapread failed\n", s);
+        exit(1);
+      }
+      close(fd);
+    }
+    exit(0);
+  }
+
+  for(i = 0; i < N; i++){
+    fd = open("mmapread", O_RDONLY);
+    if(fd < 0){
+      printf("%s: cannot open mmapread\n", s);
+      exit(1);
+    }
+    p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(p == (char*)-1){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    // the mapping holds a reference to fd's file, so read
+    // through a file of its own, which read() locks shared.
+    close(fd);
+    if((fd = open("mmapread", O_RDONLY)) < 0){
+      printf("%s: cannot reopen mmapread\n", s);
+      exit(1);
+    }
+    if(read(fd, p, SZ) != SZ){
+      printf("%s: read into mmap failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < SZ; j++){
+      if(p[j] != 'a' && p[j] != 'b'){
+        printf("%s: bad byte %x at %d\n", s, p[j], j);
+        exit(1);
+      }
+    }
+    munmap(p, SZ);
+    close(fd);
+  }
+
+  wait(&xstatus);
+  unlink("mmapread");
+  exit(xstatus);
+}
+
+// mmap(): stores reach the file and the RAID volume through
+// msync(), a forked child shares MAP_SHARED pages with its
+// parent, and MAP_PRIVATE pages are copied when written.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE };
+  static char buf[SZ], old[PGSIZE];
+  static uchar blk[BSIZE];
+  char *p, *q;
+  int fd, pid, xstatus;
+  uint blkn, blks, diskn;
+
+  unlink("mmapf");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  memset(buf, 'a', SZ);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: cannot create mmapf\n", s);
+    exit(1);
+  }
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+
+  // a store and msync() show up in the file.
+  p[0] = 'x';
+  p[PGSIZE+1] = 'y';
+  if(msync(p, SZ) != 0){
+    printf("%s: msync failed\n", s);
+    exit(1);
+  }
+  fd = open("mmapf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, SZ) != SZ || buf[0] != 'x' || buf[PGSIZE+1] != 'y' ||
+     buf[1] != 'a'){
+    printf("%s: msync'd stores not in file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // the child's stores land in the parent's pages.
+  if(p[100] != 'a' || q[100] != 'a' || q[0] != 'x'){
+    printf("%s: wrong mapped contents\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[100] = 'c';
+    q[0] = 'k';
+    if(q[0] != 'k')
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child's private store failed\n", s);
+    exit(1);
+  }
+  if(p[100] != 'c'){
+    printf("%s: child's shared store not seen by parent\n", s);
+    exit(1);
+  }
+  if(q[0] != 'x'){
+    printf("%s: child's private store seen by parent\n", s);
+    exit(1);
+  }
+
+  // a private store stays out of the file and the shared pages.
+  q[1] = 'z';
+  if(munmap(q, SZ) != 0 || munmap(p, SZ) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  fd = open("mmapf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, SZ) != SZ || buf[1] != 'a' || buf[100] != 'c'){
+    printf("%s: wrong file contents after munmap\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapf");
+
+  // the RAID volume, if there is one.
+  if(info_raid(&blkn, &blks, &diskn) < 0 || blks != BSIZE)
+    exit(0);
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_RAID, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap of RAID failed\n", s);
+    exit(1);
+  }
+  memmove(old, p, PGSIZE);
+  p[5] = ~old[5];
+  if(msync(p, PGSIZE) != 0 || read_raid(0, blk) < 0 || blk[5] != (uchar)~old[5]){
+    printf("%s: msync'd store not on RAID\n", s);
+    exit(1);
+  }
+  p[5] = old[5];
+  if(munmap(p, PGSIZE) != 0 || read_raid(0, blk) < 0 || blk[5] != (uchar)old[5]){
+    printf("%s: munmap didn't write RAID back\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// Does file name hold exactly n bytes of splicetest's pattern?
+static int
+splicecheck(char *name, int n, char *buf)
+{
+  int fd, i, r;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  r = read(fd, buf, n + 1);
+  close(fd);
+  if(r != n)
+    return 0;
+  for(i = 0; i < n; i++)
+    if(buf[i] != (char)(i % 251))
+      return 0;
+  return 1;
+}
+
+// splice() from a file to a pipe, from a pipe to a file, to
+// and from the RAID volume at unaligned and aligned offsets,
+// and into a pipe whose reader goes away part way.
+void
+splicetest(char *s)
+{
+  enum { SZ = 8*PGSIZE + 123, NSAVE = 80 };
+  static char buf[SZ + 1], save[NSAVE][BSIZE];
+  uint offs[] = { 3*BSIZE + 77, 40*BSIZE };
+  int fd, fd2, i, j, n, r, pid, xstatus, p[2];
+  uint blkn, blks, diskn, off;
+
+  unlink("splicef");
+  unlink("splicef2");
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  fd = open("splicef", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: cannot create splicef\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // file to pipe: stops at the end of the file.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    for(n = 0; (r = read(p[0], buf + n, SZ + 1 - n)) > 0; n += r)
+      ;
+    for(i = 0; i < n; i++)
+      if(buf[i] != (char)(i % 251))
+        exit(1);
+    exit(n == SZ ? 0 : 1);
+  }
+  close(p[0]);
+  fd = open("splicef", O_RDONLY);
+  if((r = splice(fd, 0, p[1], 0, SZ + 1000)) != SZ){
+    printf("%s: splice file to pipe returned %d\n", s, r);
+    exit(1);
+  }
+  close(fd);
+  close(p[1]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: wrong bytes through pipe\n", s);
+    exit(1);
+  }
+
+  // pipe to file: stops when the writer closes the pipe.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    exit(write(p[1], buf, SZ) == SZ ? 0 : 1);
+  }
+  close(p[1]);
+  fd2 = open("splicef2", O_CREATE|O_WRONLY);
+  if((r = splice(p[0], 0, fd2, 0, SZ + 1000)) != SZ){
+    printf("%s: splice pipe to file returned %d\n", s, r);
+    exit(1);
+  }
+  close(fd2);
+  close(p[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || !splicecheck("splicef2", SZ, buf)){
+    printf("%s: wrong bytes in splicef2\n", s);
+    exit(1);
+  }
+  unlink("splicef2");
+
+  // a short write: the reader takes one page and leaves,
+  // and splice() returns what it moved until then.
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    for(n = 0; n < PGSIZE && (r = read(p[0], buf, PGSIZE - n)) > 0; n += r)
+      ;
+    exit(0);
+  }
+  close(p[0]);
+  fd = open("splicef", O_RDONLY);
+  r = splice(fd, 0, p[1], 0, SZ);
+  close(fd);
+  close(p[1]);
+  wait(0);
+  if(r <= 0 || r >= SZ){
+    printf("%s: splice to a closed pipe returned %d\n", s, r);
+    exit(1);
+  }
+
+  // file to RAID and back, at an unaligned offset, where
+  // partial blocks are read first, and at an aligned one,
+  // where whole blocks go straight from the buffer cache.
+  if(info_raid(&blkn, &blks, &diskn) < 0 || blks != BSIZE || blkn < NSAVE){
+    unlink("splicef");
+    exit(0);
+  }
+  for(i = 0; i < NSAVE; i++)
+    if(read_raid(i, (uchar*)save[i]) < 0){
+      printf("%s: read_raid failed\n", s);
+      exit(1);
+    }
+  for(j = 0; j < sizeof(offs)/sizeof(offs[0]); j++){
+    off = offs[j];
+    fd = open("splicef", O_RDONLY);
+    if((r = splice(fd, 0, SPLICE_RAID, off, SZ)) != SZ){
+      printf("%s: splice file to RAID at %d returned %d\n", s, off, r);
+      exit(1);
+    }
+    close(fd);
+    unlink("splicef2");
+    fd2 = open("splicef2", O_CREATE|O_WRONLY);
+    if((r = splice(SPLICE_RAID, off, fd2, 0, SZ)) != SZ){
+      printf("%s: splice RAID at %d to file returned %d\n", s, off, r);
+      exit(1);
+    }
+    close(fd2);
+    if(!splicecheck("splicef2", SZ, buf)){
+      printf("%s: wrong bytes through RAID at %d\n", s, off);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NSAVE; i++)
+    write_raid(i, (uchar*)save[i]);
+  unlink("splicef");
+  unlink("splicef2");
+  exit(0);
+}
+
+// lseek() on a file, on a pipe, and on /dev/raid0, which
+// must read and write any bytes at any offset.
+void
+lseektest(char *s)
+{
+  enum { N = 3000, NSAVE = 8 };
+  static char buf[N], save[NSAVE][BSIZE];
+  uint blkn, blks, diskn, off;
+  int fd, i, p[2];
+
+  unlink("lseekf");
+  fd = open("lseekf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: cannot create lseekf\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 3, SEEK_SET) != 3 || read(fd, buf, 2) != 2 || buf[0] != '3' ||
+     lseek(fd, 2, SEEK_CUR) != 7 || read(fd, buf, 1) != 1 || buf[0] != '7' ||
+     lseek(fd, -4, SEEK_END) != 6 || read(fd, buf, 1) != 1 || buf[0] != '6' ||
+     lseek(fd, 0, SEEK_END) != 10 || read(fd, buf, 1) != 0){
+    printf("%s: lseek on a file went wrong\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -11, SEEK_END) != -1 || lseek(fd, -1, SEEK_SET) != -1 ||
+     lseek(fd, 0, 7) != -1 || lseek(fd, 0, SEEK_CUR) != 10){
+    printf("%s: bad lseek succeeded or moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lseekf");
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(lseek(p[0], 0, SEEK_SET) != -1 || lseek(p[1], 0, SEEK_CUR) != -1){
+    printf("%s: lseek on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+
+  fd = open("/dev/raid0", O_RDWR);
+  if(info_raid(&blkn, &blks, &diskn) < 0 || blks != BSIZE || blkn < NSAVE){
+    // no volume: an error, not an empty one.
+    if(fd >= 0 && read(fd, buf, 1) != -1){
+      printf("%s: read of /dev/raid0 without RAID didn't fail\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  if(fd < 0){
+    printf("%s: cannot open /dev/raid0\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NSAVE; i++)
+    if(read_raid(i, (uchar*)save[i]) < 0){
+      printf("%s: read_raid failed\n", s);
+      exit(1);
+    }
+  for(i = 0; i < N; i++)
+    buf[i] = i % 253;
+  off = BSIZE + 13;
+  if(lseek(fd, off, SEEK_SET) != off || write(fd, buf, N) != N ||
+     lseek(fd, -N, SEEK_CUR) != off){
+    printf("%s: unaligned write to /dev/raid0 failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, N);
+  if(read(fd, buf, N) != N){
+    printf("%s: unaligned read of /dev/raid0 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i % 253)){
+      printf("%s: /dev/raid0 byte %d is wrong\n", s, i);
+      exit(1);
+    }
+  }
+  // the neighbours of the bytes written are unchanged.
+  if(lseek(fd, BSIZE, SEEK_SET) != BSIZE || read(fd, buf, 13) != 13 ||
+     memcmp(buf, save[1], 13) != 0){
+    printf("%s: /dev/raid0 write spilled over\n", s);
+    exit(1);
+  }
+  // reads stop at the end of the volume.
+  off = blkn * BSIZE - 10;
+  if(lseek(fd, off, SEEK_SET) != off || read(fd, buf, 100) != 10 || read(fd, buf, 1) != 0){
+    printf("%s: read at the end of /dev/raid0 went wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < NSAVE; i++)
+    write_raid(i, (uchar*)save[i]);
+  exit(0);
+}
+
+// raidlib: a parent and a child that share the library's
+// /dev/raid0 descriptor read and write their own blocks at
+// the same time, so neither may move the other's requests.
+void
+raidlibtest(char *s)
+{
+  enum { NBLK = 16, N = 20 };
+  static char save[NBLK][BSIZE];
+  uint blkn, blks, diskn;
+  char *buf;
+  int i, j, k, pid, xstatus, bad;
+  struct raidstats st;
+
+  if(raidinfo(&blkn, &blks, &diskn) < 0 || blks != BSIZE || blkn < NBLK)
+    exit(0);
+  if(raidreadblocks(0, NBLK, BSIZE, save) < 0){
+    printf("%s: raidreadblocks failed\n", s);
+    exit(1);
+  }
+  if((buf = raidalloc(BSIZE)) == 0){
+    printf("%s: raidalloc failed\n", s);
+    exit(1);
+  }
+  // open the device before fork(), so both share it.
+  raidread(0, buf, 1);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  // the parent uses the even blocks, the child the odd ones.
+  k = pid == 0;
+  bad = 0;
+  for(i = 0; i < N; i++){
+    for(j = k; j < NBLK; j += 2){
+      memset(buf, 'a' + j, BSIZE);
+      if(raidwrite(j * BSIZE, buf, BSIZE) != BSIZE)
+        bad = 1;
+    }
+    for(j = k; j < NBLK; j += 2){
+      if(raidread(j * BSIZE + 7, buf, 10) != 10 || buf[0] != 'a' + j || buf[9] != 'a' + j)
+        bad = 1;
+    }
+  }
+  raidstats(&st);
+  if(st.writes < N * NBLK / 2 || st.wbytes < (uint64)N * NBLK / 2 * BSIZE)
+    bad = 1;
+  if(pid == 0)
+    exit(bad);
+  wait(&xstatus);
+  raidwriteblocks(0, NBLK, BSIZE, save);
+  raidfree(buf);
+  if(bad || xstatus != 0){
+    printf("%s: RAID requests went astray\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
 // four processes write different files at the same
 // time, to test block allocation.
 void
@@ -2606,6 +3122,11 @@ struct test {
   {forkforkfork, "forkforkfork"},
   {reparent2, "reparent2"},
   {sharedfd, "sharedfd"},
+  {mmapread, "mmapread"},
+  {mmaptest, "mmaptest"},
+  {splicetest, "splicetest"},
+  {lseektest, "lseektest"},
+  {raidlibtest, "raidlibtest"},
   {fourfiles, "fourfiles"},
   {createdelete, "createdelete"},
   {unlinkread, "unlinkread"},
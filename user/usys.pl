@@ -43,4 +43,11 @@ entry("write_raid");
 entry("disk_fail_raid");
 entry("disk_repaired_raid");
 entry("info_raid");
-entry("destroy_raid");
\ No newline at end of file
+entry("destroy_raid");
+entry("mmap");
+entry("munmap");
+entry("msync");
+entry("splice");
+entry("lseek");
+entry("pread");
+entry("pwrite");
\ No newline at end of file
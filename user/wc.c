@@ -1,34 +1,51 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
 char buf[512];
+int l, w, c, inword;
+
+void
+count(char *p, int n)
+{
+  int i;
+
+  for(i=0; i<n; i++){
+    c++;
+    if(p[i] == '\n')
+      l++;
+    if(strchr(" \r\t\n\v", p[i]))
+      inword = 0;
+    else if(!inword){
+      w++;
+      inword = 1;
+    }
+  }
+}
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
-  int l, w, c, inword;
+  int n;
+  struct stat st;
+  char *p;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+  // scan a regular file in place, without read()ing it.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+     (p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) != (char*)-1){
+    count(p, st.size);
+    munmap(p, st.size);
+  } else {
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      count(buf, n);
+    if(n < 0){
+      printf("wc: read error\n");
+      exit(1);
     }
   }
-  if(n < 0){
-    printf("wc: read error\n");
-    exit(1);
-  }
   printf("%d %d %d %s\n", l, w, c, name);
 }
 